@@ -3,6 +3,7 @@
 #include <limits.h>
 #include <round.h>
 #include <stdio.h>
+#include <string.h>
 #include "threads/malloc.h"
 #ifdef FILESYS
 #include "filesys/file.h"
@@ -21,13 +22,24 @@ typedef unsigned long elem_type;
 /* Number of bits in an element. */
 #define ELEM_BITS (sizeof (elem_type) * CHAR_BIT)
 
+/* Number of elements summarized by one group count.  A scan
+   skips a whole group at once when its count shows that it has
+   no bit of the value being searched for. */
+#define GROUP_ELEMS 32
+#define GROUP_BITS (GROUP_ELEMS * ELEM_BITS)
+
 /* From the outside, a bitmap is an array of bits.  From the
    inside, it's an array of elem_type (defined above) that
-   simulates an array of bits. */
+   simulates an array of bits, plus a summary that counts the
+   true bits in each group of GROUP_ELEMS elements.  The counts
+   stay exact as long as callers serialize modifications, which
+   they must do anyway for bitmap_scan_and_flip(). */
 struct bitmap
   {
     size_t bit_cnt;     /* Number of bits. */
+    size_t next;        /* Where the next next-fit scan starts. */
     elem_type *bits;    /* Elements that represent bits. */
+    uint16_t *groups;   /* Number of true bits in each group. */
   };
 
 /* Returns the index of the element that contains the bit
@@ -60,6 +72,68 @@ byte_cnt (size_t bit_cnt)
   return sizeof (elem_type) * elem_cnt (bit_cnt);
 }
 
+/* Returns the number of group counts required for BIT_CNT
+   bits. */
+static inline size_t
+group_cnt (size_t bit_cnt)
+{
+  return DIV_ROUND_UP (bit_cnt, GROUP_BITS);
+}
+
+/* Returns the number of bytes required for BIT_CNT bits and
+   their group counts. */
+static inline size_t
+storage_size (size_t bit_cnt)
+{
+  return byte_cnt (bit_cnt) + sizeof (uint16_t) * group_cnt (bit_cnt);
+}
+
+/* Returns the number of bits of B that lie in group GROUP. */
+static inline size_t
+group_size (const struct bitmap *b, size_t group)
+{
+  size_t left = b->bit_cnt - group * GROUP_BITS;
+  return left < GROUP_BITS ? left : GROUP_BITS;
+}
+
+/* Returns the number of bits set to 1 in ELEM.
+   Written out because the kernel is not linked with libgcc. */
+static inline size_t
+count_ones (elem_type elem)
+{
+  size_t cnt = 0;
+  for (; elem != 0; elem &= elem - 1)
+    cnt++;
+  return cnt;
+}
+
+/* Sets element IDX of B to ELEM, keeping its group count
+   up to date. */
+static inline void
+store_elem (struct bitmap *b, size_t idx, elem_type elem)
+{
+  elem_type old = b->bits[idx];
+  if (old != elem)
+    {
+      b->groups[idx / GROUP_ELEMS] += count_ones (elem) - count_ones (old);
+      b->bits[idx] = elem;
+    }
+}
+
+#ifdef FILESYS
+/* Recomputes every group count of B from its bits. */
+static void
+recount_groups (struct bitmap *b)
+{
+  size_t i;
+
+  for (i = 0; i < group_cnt (b->bit_cnt); i++)
+    b->groups[i] = 0;
+  for (i = 0; i < elem_cnt (b->bit_cnt); i++)
+    b->groups[i / GROUP_ELEMS] += count_ones (b->bits[i]);
+}
+#endif
+
 /* Returns a bit mask in which the bits actually used in the last
    element of B's bits are set to 1 and the rest are set to 0. */
 static inline elem_type
@@ -82,10 +156,12 @@ bitmap_create (size_t bit_cnt)
   if (b != NULL)
     {
       b->bit_cnt = bit_cnt;
-      b->bits = malloc (byte_cnt (bit_cnt));
+      b->next = 0;
+      b->bits = malloc (storage_size (bit_cnt));
       if (b->bits != NULL || bit_cnt == 0)
         {
-          bitmap_set_all (b, false);
+          b->groups = (uint16_t *) (b->bits + elem_cnt (bit_cnt));
+          memset (b->bits, 0, storage_size (bit_cnt));
           return b;
         }
       free (b);
@@ -104,8 +180,10 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
   ASSERT (block_size >= bitmap_buf_size (bit_cnt));
 
   b->bit_cnt = bit_cnt;
+  b->next = 0;
   b->bits = (elem_type *) (b + 1);
-  bitmap_set_all (b, false);
+  b->groups = (uint16_t *) (b->bits + elem_cnt (bit_cnt));
+  memset (b->bits, 0, storage_size (bit_cnt));
   return b;
 }
 
@@ -114,7 +192,7 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
 size_t
 bitmap_buf_size (size_t bit_cnt) 
 {
-  return sizeof (struct bitmap) + byte_cnt (bit_cnt);
+  return sizeof (struct bitmap) + storage_size (bit_cnt);
 }
 
 /* Destroys bitmap B, freeing its storage.
@@ -141,7 +219,8 @@ bitmap_size (const struct bitmap *b)
 
 /* Setting and testing single bits. */
 
-/* Atomically sets the bit numbered IDX in B to VALUE. */
+/* Sets the bit numbered IDX in B to VALUE.  Not atomic; see
+   bitmap_mark(). */
 void
 bitmap_set (struct bitmap *b, size_t idx, bool value) 
 {
@@ -153,44 +232,59 @@ bitmap_set (struct bitmap *b, size_t idx, bool value)
     bitmap_reset (b, idx);
 }
 
-/* Atomically sets the bit numbered BIT_IDX in B to true. */
+/* Sets the bit numbered BIT_IDX in B to true.
+   The bit and its group count are updated in separate steps, so
+   this is not atomic: concurrent updates of B must be
+   synchronized by the caller. */
 void
 bitmap_mark (struct bitmap *b, size_t bit_idx) 
 {
   size_t idx = elem_idx (bit_idx);
   elem_type mask = bit_mask (bit_idx);
 
-  /* This is equivalent to `b->bits[idx] |= mask' except that it
-     is guaranteed to be atomic on a uniprocessor machine.  See
-     the description of the OR instruction in [IA32-v2b]. */
+  if (b->bits[idx] & mask)
+    return;
+  b->groups[idx / GROUP_ELEMS]++;
+
+  /* This is equivalent to `b->bits[idx] |= mask', as a single
+     OR instruction.  See [IA32-v2b]. */
   asm ("orl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
 }
 
-/* Atomically sets the bit numbered BIT_IDX in B to false. */
+/* Sets the bit numbered BIT_IDX in B to false.
+   Like bitmap_mark(), this is not atomic. */
 void
 bitmap_reset (struct bitmap *b, size_t bit_idx) 
 {
   size_t idx = elem_idx (bit_idx);
   elem_type mask = bit_mask (bit_idx);
 
-  /* This is equivalent to `b->bits[idx] &= ~mask' except that it
-     is guaranteed to be atomic on a uniprocessor machine.  See
-     the description of the AND instruction in [IA32-v2a]. */
+  if (!(b->bits[idx] & mask))
+    return;
+  b->groups[idx / GROUP_ELEMS]--;
+
+  /* This is equivalent to `b->bits[idx] &= ~mask', as a single
+     AND instruction.  See [IA32-v2a]. */
   asm ("andl %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
 }
 
-/* Atomically toggles the bit numbered IDX in B;
+/* Toggles the bit numbered IDX in B;
    that is, if it is true, makes it false,
-   and if it is false, makes it true. */
+   and if it is false, makes it true.
+   Like bitmap_mark(), this is not atomic. */
 void
 bitmap_flip (struct bitmap *b, size_t bit_idx) 
 {
   size_t idx = elem_idx (bit_idx);
   elem_type mask = bit_mask (bit_idx);
 
-  /* This is equivalent to `b->bits[idx] ^= mask' except that it
-     is guaranteed to be atomic on a uniprocessor machine.  See
-     the description of the XOR instruction in [IA32-v2b]. */
+  if (b->bits[idx] & mask)
+    b->groups[idx / GROUP_ELEMS]--;
+  else
+    b->groups[idx / GROUP_ELEMS]++;
+
+  /* This is equivalent to `b->bits[idx] ^= mask', as a single
+     XOR instruction.  See [IA32-v2b]. */
   asm ("xorl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
 }
 
@@ -214,18 +308,76 @@ bitmap_set_all (struct bitmap *b, bool value)
   bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
+/* Returns a mask of the bits of element IDX that lie between
+   START and END, exclusive. */
+static inline elem_type
+range_mask (size_t idx, size_t start, size_t end)
+{
+  size_t first = idx * ELEM_BITS;
+  elem_type mask = (elem_type) -1;
+
+  if (start > first)
+    mask &= (elem_type) -1 << (start - first);
+  if (end < first + ELEM_BITS)
+    mask &= ((elem_type) 1 << (end - first)) - 1;
+  return mask;
+}
+
+/* Returns the index of the first bit in B between START and
+   END, exclusive, that is set to VALUE, or END if there is
+   none.  Looks at a whole element at a time, and at a whole
+   group of elements at a time where the group counts show that
+   none of its bits can match. */
+static size_t
+find_bit (const struct bitmap *b, size_t start, size_t end, bool value)
+{
+  elem_type flip = value ? 0 : (elem_type) -1;
+  size_t last, idx;
+
+  if (start >= end)
+    return end;
+  last = elem_idx (end - 1);
+  idx = elem_idx (start);
+  for (;;)
+    {
+      elem_type elem = (b->bits[idx] ^ flip) & range_mask (idx, start, end);
+      if (elem != 0)
+        return idx * ELEM_BITS + __builtin_ctzl (elem);
+      if (++idx > last)
+        return end;
+
+      /* At a group boundary, skip groups with nothing to find. */
+      while (idx % GROUP_ELEMS == 0)
+        {
+          size_t group = idx / GROUP_ELEMS;
+          size_t ones = b->groups[group];
+          if (ones != (value ? 0 : group_size (b, group)))
+            break;
+          idx += GROUP_ELEMS;
+          if (idx > last)
+            return end;
+        }
+    }
+}
+
 /* Sets the CNT bits starting at START in B to VALUE. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
+  size_t end = start + cnt;
+  size_t idx;
   
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    bitmap_set (b, start + i, value);
+  if (cnt == 0)
+    return;
+  for (idx = elem_idx (start); idx <= elem_idx (end - 1); idx++)
+    {
+      elem_type mask = range_mask (idx, start, end);
+      store_elem (b, idx, value ? b->bits[idx] | mask : b->bits[idx] & ~mask);
+    }
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -233,17 +385,34 @@ bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i, value_cnt;
+  size_t end = start + cnt;
+  size_t idx, ones;
 
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  value_cnt = 0;
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      value_cnt++;
-  return value_cnt;
+  if (cnt == 0)
+    return 0;
+  ones = 0;
+  idx = elem_idx (start);
+  while (idx <= elem_idx (end - 1))
+    {
+      size_t group = idx / GROUP_ELEMS;
+      if (idx % GROUP_ELEMS == 0 && idx * ELEM_BITS >= start
+          && idx * ELEM_BITS + group_size (b, group) <= end)
+        {
+          /* Whole group inside the range: use its count. */
+          ones += b->groups[group];
+          idx += GROUP_ELEMS;
+        }
+      else
+        {
+          ones += count_ones (b->bits[idx] & range_mask (idx, start, end));
+          idx++;
+        }
+    }
+  return value ? ones : cnt - ones;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -251,16 +420,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
-  return false;
+  return find_bit (b, start, start + cnt, value) != start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -299,13 +463,21 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
+  if (cnt == 0)
+    return start;
   if (cnt <= b->bit_cnt) 
     {
       size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      size_t i = find_bit (b, start, b->bit_cnt, value);
+      while (i <= last)
+        {
+          /* I starts a run of VALUE bits.  If it is too short,
+             resume after the bit that ended it. */
+          size_t stop = find_bit (b, i, i + cnt, !value);
+          if (stop == i + cnt)
+            return i;
+          i = find_bit (b, stop, b->bit_cnt, value);
+        }
     }
   return BITMAP_ERROR;
 }
@@ -315,8 +487,8 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
    and returns the index of the first bit in the group.
    If there is no such group, returns BITMAP_ERROR.
    If CNT is zero, returns 0.
-   Bits are set atomically, but testing bits is not atomic with
-   setting them. */
+   Neither testing nor setting the bits is atomic, so callers
+   must synchronize access to B. */
 size_t
 bitmap_scan_and_flip (struct bitmap *b, size_t start, size_t cnt, bool value)
 {
@@ -325,6 +497,24 @@ bitmap_scan_and_flip (struct bitmap *b, size_t start, size_t cnt, bool value)
     bitmap_set_multiple (b, idx, cnt, !value);
   return idx;
 }
+
+/* Like bitmap_scan_and_flip(), but starts where the previous
+   call on B left off and wraps around to the beginning (next
+   fit), so that a mostly full bitmap is not rescanned from bit 0
+   every time. */
+size_t
+bitmap_scan_and_flip_next (struct bitmap *b, size_t cnt, bool value)
+{
+  size_t idx = bitmap_scan (b, b->next, cnt, value);
+  if (idx == BITMAP_ERROR && b->next != 0)
+    idx = bitmap_scan (b, 0, cnt, value);
+  if (idx != BITMAP_ERROR)
+    {
+      bitmap_set_multiple (b, idx, cnt, !value);
+      b->next = idx + cnt < b->bit_cnt ? idx + cnt : 0;
+    }
+  return idx;
+}
 
 /* File input and output. */
 
@@ -347,6 +537,7 @@ bitmap_read (struct bitmap *b, struct file *file)
       off_t size = byte_cnt (b->bit_cnt);
       success = file_read_at (file, b->bits, size, 0) == size;
       b->bits[elem_cnt (b->bit_cnt) - 1] &= last_mask (b);
+      recount_groups (b);
     }
   return success;
 }
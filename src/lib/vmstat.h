@@ -0,0 +1,32 @@
+#ifndef __LIB_VMSTAT_H
+#define __LIB_VMSTAT_H
+
+/* Virtual memory counters, as filled in by the vmstat() system
+   call and printed at shutdown.  The fault and paging counters
+   belong to one process; the last group is system-wide. */
+struct vmstat
+  {
+    /* Page faults resolved, by what they had to do.  Each fault
+       is counted in exactly one of these. */
+    long long zero_faults;      /* Mapped a zero-filled page. */
+    long long file_faults;      /* Read a page from a file. */
+    long long swap_faults;      /* Read a page back from swap. */
+    long long stack_faults;     /* Grew the stack. */
+    long long cow_faults;       /* Broke copy-on-write sharing. */
+
+    /* Paging out. */
+    long long evictions;        /* Pages whose frame was taken away. */
+    long long writebacks;       /* Dirty mmap pages written to files. */
+    long long swap_outs;        /* Pages written to swap. */
+
+    /* Resident set, filled in for one process only. */
+    long long rss;              /* Private frames resident. */
+    long long wss;              /* Estimated working set, in pages. */
+
+    /* System-wide. */
+    long long swap_slots;       /* Swap disk slots in use. */
+    long long zswap_pages;      /* Pages in the compressed swap cache. */
+    long long clock_laps;       /* Full sweeps of the eviction clock. */
+  };
+
+#endif /* lib/vmstat.h */
@@ -0,0 +1,55 @@
+/* Forks a child, then has both processes overwrite the same
+   buffer.  Each must see only its own writes: the child must
+   still see the data from before the fork even if the parent
+   writes first, and the parent must not see the child's
+   writes. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (64 * 1024)
+
+static char buf[SIZE];
+
+/* Fails unless every byte of BUF is C. */
+static void
+check_fill (char c, const char *who)
+{
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != c)
+      fail ("%s: byte %zu is '%c' instead of '%c'", who, i, buf[i], c);
+}
+
+void
+test_main (void)
+{
+  pid_t pid;
+  int status;
+
+  memset (buf, 'a', SIZE);
+
+  pid = fork ();
+  if (pid == 0)
+    {
+      check_fill ('a', "child");
+      msg ("child: sees data from before fork");
+      memset (buf, 'c', SIZE);
+      check_fill ('c', "child");
+      msg ("child: sees its own writes");
+      exit (0);
+    }
+  if (pid < 0)
+    fail ("fork failed");
+
+  /* Write while the child may still be reading. */
+  memset (buf, 'p', SIZE);
+  status = wait (pid);
+  CHECK (status == 0, "wait for child");
+
+  check_fill ('p', "parent");
+  msg ("parent: sees only its own writes");
+}
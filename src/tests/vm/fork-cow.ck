@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fork-cow) begin
+(fork-cow) child: sees data from before fork
+(fork-cow) child: sees its own writes
+(fork-cow) wait for child
+(fork-cow) parent: sees only its own writes
+(fork-cow) end
+EOF
+pass;
@@ -0,0 +1,65 @@
+/* Forks a process with 2 MB of data, so that the parent's and
+   the child's copies together do not fit in memory.  The child
+   reads every page, which evicts frames that are still shared
+   copy-on-write, then overwrites them all.  Both must end up
+   seeing their own data. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (2 * 1024 * 1024)
+
+static unsigned char buf[SIZE];
+
+/* Byte that position I of BUF holds in the parent. */
+static unsigned char
+pattern (size_t i)
+{
+  return (i * 31) ^ (i >> 12);
+}
+
+/* Fails unless every byte of BUF is pattern(), or its
+   complement if INVERT. */
+static void
+check_buf (bool invert, const char *who)
+{
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    {
+      unsigned char expect = invert ? ~pattern (i) : pattern (i);
+      if (buf[i] != expect)
+        fail ("%s: byte %zu is %d instead of %d", who, i, buf[i], expect);
+    }
+}
+
+void
+test_main (void)
+{
+  pid_t pid;
+  int status;
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    buf[i] = pattern (i);
+
+  pid = fork ();
+  if (pid == 0)
+    {
+      check_buf (false, "child");
+      msg ("child: read pass");
+      for (i = 0; i < SIZE; i++)
+        buf[i] = ~pattern (i);
+      check_buf (true, "child");
+      msg ("child: write pass");
+      exit (0);
+    }
+  if (pid < 0)
+    fail ("fork failed");
+
+  status = wait (pid);
+  CHECK (status == 0, "wait for child");
+  check_buf (false, "parent");
+  msg ("parent: read pass");
+}
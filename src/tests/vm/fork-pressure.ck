@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fork-pressure) begin
+(fork-pressure) child: read pass
+(fork-pressure) child: write pass
+(fork-pressure) wait for child
+(fork-pressure) parent: read pass
+(fork-pressure) end
+EOF
+pass;
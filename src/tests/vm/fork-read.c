@@ -0,0 +1,38 @@
+/* Forks a child and checks that it sees the data the parent
+   wrote before the fork, and that its exit status comes back
+   through wait(). */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (64 * 1024)
+
+static char buf[SIZE];
+
+void
+test_main (void)
+{
+  pid_t pid;
+  int status;
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    buf[i] = i % 251;
+
+  pid = fork ();
+  if (pid == 0)
+    {
+      for (i = 0; i < SIZE; i++)
+        if (buf[i] != (char) (i % 251))
+          fail ("child: byte %zu is %d instead of %d",
+                i, buf[i], (char) (i % 251));
+      msg ("child: data matches");
+      exit (81);
+    }
+  if (pid < 0)
+    fail ("fork failed");
+
+  status = wait (pid);
+  CHECK (status == 81, "wait for child");
+}
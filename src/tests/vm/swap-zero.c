@@ -0,0 +1,35 @@
+/* Dirties 6 MB of memory without changing it from zeros, which
+   is more than fits in RAM, then reads it back.  Pages that are
+   all zeros must be paged out without using any swap disk
+   slots. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (6 * 1024 * 1024)
+#define PAGE_SIZE 4096
+
+static char buf[SIZE];
+
+void
+test_main (void)
+{
+  struct vmstat before, after;
+  size_t i;
+
+  CHECK (vmstat (&before), "vmstat");
+
+  msg ("write pass");
+  for (i = 0; i < SIZE; i += PAGE_SIZE)
+    buf[i] = 0;
+
+  msg ("read pass");
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != 0)
+      fail ("byte %zu != 0", i);
+
+  CHECK (vmstat (&after), "vmstat");
+  CHECK (after.swap_outs > before.swap_outs, "pages were paged out");
+  CHECK (after.swap_slots == 0, "no swap slots in use");
+}
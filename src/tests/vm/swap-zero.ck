@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(swap-zero) begin
+(swap-zero) vmstat
+(swap-zero) write pass
+(swap-zero) read pass
+(swap-zero) vmstat
+(swap-zero) pages were paged out
+(swap-zero) no swap slots in use
+(swap-zero) end
+EOF
+pass;
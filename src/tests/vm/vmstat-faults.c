@@ -0,0 +1,48 @@
+/* Takes zero-page faults in the BSS and stack-growth faults,
+   and checks that vmstat() counts each in its own category:
+   growing the stack must not also count as a zero fault. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 16
+
+static char buf[PAGE_CNT * PAGE_SIZE];
+
+/* Touches every page of a large stack object, so that the stack
+   grows by about PAGE_CNT pages. */
+static void __attribute__ ((noinline))
+grow_stack (void)
+{
+  char stack_obj[PAGE_CNT * PAGE_SIZE];
+  size_t i;
+
+  for (i = sizeof stack_obj; i >= PAGE_SIZE; i -= PAGE_SIZE)
+    stack_obj[i - 1] = 1;
+  asm volatile ("" : : "r" (stack_obj) : "memory");
+}
+
+void
+test_main (void)
+{
+  struct vmstat before, mid, after;
+  size_t i;
+
+  CHECK (vmstat (&before), "vmstat");
+  msg ("touch BSS");
+  for (i = 0; i < sizeof buf; i += PAGE_SIZE)
+    buf[i] = 1;
+  CHECK (vmstat (&mid), "vmstat");
+  CHECK (mid.zero_faults - before.zero_faults >= PAGE_CNT,
+         "BSS pages counted as zero faults");
+
+  msg ("grow stack");
+  grow_stack ();
+  CHECK (vmstat (&after), "vmstat");
+  CHECK (after.stack_faults - mid.stack_faults >= PAGE_CNT - 1,
+         "stack pages counted as stack faults");
+  CHECK (after.zero_faults == mid.zero_faults,
+         "stack pages not counted as zero faults");
+}
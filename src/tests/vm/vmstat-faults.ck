@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(vmstat-faults) begin
+(vmstat-faults) vmstat
+(vmstat-faults) touch BSS
+(vmstat-faults) vmstat
+(vmstat-faults) BSS pages counted as zero faults
+(vmstat-faults) grow stack
+(vmstat-faults) vmstat
+(vmstat-faults) stack pages counted as stack faults
+(vmstat-faults) stack pages not counted as zero faults
+(vmstat-faults) end
+EOF
+pass;
@@ -21,6 +21,7 @@
 #include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/pte.h"
+#include "threads/slab.h"
 #include "threads/thread.h"
 #ifdef USERPROG
 #include "userprog/process.h"
@@ -28,6 +29,12 @@
 #include "userprog/gdt.h"
 #include "userprog/syscall.h"
 #include "userprog/tss.h"
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/pagecache.h"
+#include "vm/swap.h"
+#endif
 #else
 #include "tests/threads/tests.h"
 #endif
@@ -97,7 +104,13 @@ main (void)
   /* Initialize memory system. */
   palloc_init (user_page_limit);
   malloc_init ();
+  slab_init ();
   paging_init ();
+#ifdef VM
+  frame_init ();
+  vm_page_init ();
+  pagecache_init ();
+#endif
 
   /* Segmentation. */
 #ifdef USERPROG
@@ -127,6 +140,10 @@ main (void)
   filesys_init (format_filesys);
 #endif
 
+#ifdef VM
+  vm_swap_init ();
+#endif
+
   printf ("Boot complete.\n");
   
   /* Run actions specified on kernel command line. */
@@ -259,6 +276,23 @@ parse_options (char **argv)
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+#endif
+#ifdef VM
+      else if (!strcmp (name, "-sl"))
+        {
+          /* Keep PHYS_BASE - limit * PGSIZE from wrapping. */
+          int pages = atoi (value);
+          if (pages < 0)
+            pages = 0;
+          vm_stack_page_limit = (size_t) pages < VM_STACK_PAGE_LIMIT_MAX
+                                ? (size_t) pages : VM_STACK_PAGE_LIMIT_MAX;
+        }
+      else if (!strcmp (name, "-fa"))
+        vm_fault_around_pages = atoi (value);
+      else if (!strcmp (name, "-rss"))
+        vm_rss_limit = atoi (value);
+      else if (!strcmp (name, "-zswap"))
+        vm_zswap_pool_pages = atoi (value);
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -381,6 +415,12 @@ usage (void)
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+          "  -sl=COUNT          Limit each user stack to COUNT pages.\n"
+          "  -fa=COUNT          Map up to COUNT cached pages per fault.\n"
+          "  -rss=COUNT         Keep at most COUNT frames per process.\n"
+          "  -zswap=COUNT       Use up to COUNT pages for compressed swap.\n"
 #endif
           );
   shutdown_power_off ();
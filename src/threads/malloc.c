@@ -5,8 +5,10 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* A simple implementation of malloc().
@@ -32,15 +34,41 @@
    because they're too big to fit in a single page with a
    descriptor.  We handle those by allocating contiguous pages
    with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   the beginning of the allocated block's arena header.
+
+   In front of the descriptors, each thread keeps a "magazine"
+   of free blocks per descriptor.  free() pushes onto the
+   running thread's magazine and malloc() pops from it, without
+   taking the descriptor's lock.  Only when a magazine is empty
+   or full does it refill or flush half a magazine's worth of
+   blocks under a single lock acquisition.  Blocks in a magazine
+   still count as in use in their arena, so an arena is not
+   given back while any of its blocks is cached.  Magazines are
+   flushed when their thread exits, and all of them are flushed
+   when the kernel pool runs out of pages.
+
+   Magazine operations run with interrupts off instead of under
+   a lock, so that the reclaimer can empty other threads'
+   magazines safely. */
+
+/* Bytes of blocks a full magazine holds, and the least number of
+   blocks it holds regardless of block size. */
+#define MAGAZINE_BYTES 1024
+#define MAGAZINE_MIN 2
 
 /* Descriptor. */
 struct desc
   {
     size_t block_size;          /* Size of each element in bytes. */
     size_t blocks_per_arena;    /* Number of blocks in an arena. */
+    size_t magazine_size;       /* Blocks in a full magazine. */
     struct list free_list;      /* List of free blocks. */
     struct lock lock;           /* Lock. */
+
+    /* Statistics. */
+    size_t arena_cnt;           /* Arenas held. */
+    size_t in_use;              /* Blocks handed out. */
+    size_t peak_in_use;         /* Largest IN_USE seen. */
   };
 
 /* Magic number for detecting arena corruption. */
@@ -58,14 +86,38 @@ struct arena
 struct block 
   {
     struct list_elem free_elem; /* Free list element. */
+    struct block *next;         /* Next block in a magazine. */
   };
 
 /* Our set of descriptors. */
-static struct desc descs[10];   /* Descriptors. */
+static struct desc descs[MALLOC_DESC_CNT]; /* Descriptors. */
 static size_t desc_cnt;         /* Number of descriptors. */
 
+/* Blocks taken out of every thread's magazines by
+   malloc_reclaim(), one chain per descriptor, and the lock that
+   lets only one reclaim use them at a time. */
+static struct magazine reclaimed[MALLOC_DESC_CNT];
+static struct lock reclaim_lock;
+
+/* Statistics for blocks too big for any descriptor.  Updated with
+   interrupts off. */
+static size_t big_cnt;          /* Big blocks handed out. */
+static size_t big_pages;        /* Pages they use. */
+static size_t peak_big_pages;   /* Largest BIG_PAGES seen. */
+
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
+static struct block *refill_magazine (struct desc *, struct magazine *);
+static void flush_magazine (struct desc *, struct magazine *, size_t cnt);
+static size_t malloc_reclaim (enum palloc_flags, size_t page_cnt);
+static void *raw_malloc (size_t);
+static void *raw_realloc (void *, size_t);
+static void raw_free (void *);
+#ifdef MALLOC_DEBUG
+static void *debug_malloc (size_t, void *caller);
+static void *debug_realloc (void *, size_t, void *caller);
+static void debug_free (void *, void *caller);
+#endif
 
 /* Initializes the malloc() descriptors. */
 void
@@ -79,19 +131,106 @@ malloc_init (void)
       ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
       d->block_size = block_size;
       d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
+      d->magazine_size = MAGAZINE_BYTES / block_size;
+      if (d->magazine_size < MAGAZINE_MIN)
+        d->magazine_size = MAGAZINE_MIN;
       list_init (&d->free_list);
       lock_init (&d->lock);
     }
+  ASSERT (desc_cnt == MALLOC_DESC_CNT);
+  lock_init (&reclaim_lock);
+  palloc_register_reclaimer (malloc_reclaim);
+}
+
+/* Pushes B onto magazine M.  Interrupts must be off. */
+static void
+magazine_push (struct magazine *m, struct block *b)
+{
+  b->next = m->top;
+  m->top = b;
+  m->cnt++;
+}
+
+/* Pops a block from magazine M, or returns a null pointer if M
+   is empty.  Interrupts must be off. */
+static struct block *
+magazine_pop (struct magazine *m)
+{
+  struct block *b = m->top;
+  if (b != NULL)
+    {
+      m->top = b->next;
+      m->cnt--;
+    }
+  return b;
+}
+
+/* Removes a block from D's free list, which must not be empty,
+   and returns it.  D's lock must be held. */
+static struct block *
+take_block (struct desc *d)
+{
+  struct block *b = list_entry (list_pop_front (&d->free_list),
+                                struct block, free_elem);
+  block_to_arena (b)->free_cnt--;
+  return b;
+}
+
+/* Returns true if no block of arena A, which belongs to D, is in
+   use or cached in a magazine. */
+static bool
+arena_is_idle (const struct desc *d, const struct arena *a)
+{
+  return a->free_cnt == d->blocks_per_arena;
+}
+
+/* Removes the blocks of idle arena A from D's free list and gives
+   A back to the page allocator.  D's lock must be held. */
+static void
+free_arena (struct desc *d, struct arena *a)
+{
+  size_t i;
+
+  ASSERT (arena_is_idle (d, a));
+  for (i = 0; i < d->blocks_per_arena; i++) 
+    {
+      struct block *b = arena_to_block (a, i);
+      list_remove (&b->free_elem);
+    }
+  d->arena_cnt--;
+  palloc_free_page (a);
+}
+
+/* Adds B, which belongs to D, to D's free list.  If that left
+   B's arena unused, frees the arena.  Returns true if the arena
+   was freed.  D's lock must be held. */
+static bool
+release_block (struct desc *d, struct block *b)
+{
+  struct arena *a = block_to_arena (b);
+
+  list_push_front (&d->free_list, &b->free_elem);
+
+  /* If the arena is now entirely unused, free it. */
+  if (++a->free_cnt >= d->blocks_per_arena) 
+    {
+      ASSERT (a->free_cnt == d->blocks_per_arena);
+      free_arena (d, a);
+      return true;
+    }
+  return false;
 }
 
 /* Obtains and returns a new block of at least SIZE bytes.
    Returns a null pointer if memory is not available. */
-void *
-malloc (size_t size) 
+static void *
+raw_malloc (size_t size)
 {
   struct desc *d;
   struct block *b;
   struct arena *a;
+  struct magazine *m;
+  enum intr_level old_level;
 
   /* A null pointer satisfies a request for 0 bytes. */
   if (size == 0)
@@ -116,28 +255,67 @@ malloc (size_t size)
       a->magic = ARENA_MAGIC;
       a->desc = NULL;
       a->free_cnt = page_cnt;
+
+      old_level = intr_disable ();
+      big_cnt++;
+      big_pages += page_cnt;
+      if (big_pages > peak_big_pages)
+        peak_big_pages = big_pages;
+      intr_set_level (old_level);
       return a + 1;
     }
 
+  /* Take a block from the running thread's magazine if it has
+     one, otherwise refill the magazine from the free list. */
+  m = &thread_current ()->magazines[d - descs];
+  old_level = intr_disable ();
+  b = magazine_pop (m);
+  intr_set_level (old_level);
+  if (b == NULL)
+    b = refill_magazine (d, m);
+
+  if (b != NULL)
+    {
+      old_level = intr_disable ();
+      if (++d->in_use > d->peak_in_use)
+        d->peak_in_use = d->in_use;
+      intr_set_level (old_level);
+    }
+  return b;
+}
+
+/* Moves half a magazine's worth of blocks from D's free list to
+   magazine M, creating a new arena if the free list is empty,
+   and returns one more block for the caller.  Returns a null
+   pointer if no memory is available. */
+static struct block *
+refill_magazine (struct desc *d, struct magazine *m)
+{
+  struct block *b;
+  struct arena *a;
+  size_t cnt;
+
   lock_acquire (&d->lock);
 
-  /* If the free list is empty, create a new arena. */
+  /* If the free list is empty, create a new arena.  The page is
+     obtained without holding the lock, so that palloc's
+     reclaimers may flush magazines into this descriptor. */
   if (list_empty (&d->free_list))
     {
       size_t i;
 
       /* Allocate a page. */
+      lock_release (&d->lock);
       a = palloc_get_page (0);
       if (a == NULL) 
-        {
-          lock_release (&d->lock);
-          return NULL; 
-        }
+        return NULL; 
+      lock_acquire (&d->lock);
 
       /* Initialize arena and add its blocks to the free list. */
       a->magic = ARENA_MAGIC;
       a->desc = d;
       a->free_cnt = d->blocks_per_arena;
+      d->arena_cnt++;
       for (i = 0; i < d->blocks_per_arena; i++) 
         {
           struct block *b = arena_to_block (a, i);
@@ -145,14 +323,135 @@ malloc (size_t size)
         }
     }
 
-  /* Get a block from free list and return it. */
-  b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
-  a = block_to_arena (b);
-  a->free_cnt--;
+  /* Take one block for the caller and up to half a magazine
+     more for later calls. */
+  b = take_block (d);
+  for (cnt = 0; cnt < d->magazine_size / 2 && !list_empty (&d->free_list);
+       cnt++)
+    {
+      struct block *extra = take_block (d);
+      enum intr_level old_level = intr_disable ();
+      magazine_push (m, extra);
+      intr_set_level (old_level);
+    }
   lock_release (&d->lock);
   return b;
 }
 
+/* Moves up to CNT blocks from magazine M back to D's free list,
+   under a single acquisition of D's lock. */
+static void
+flush_magazine (struct desc *d, struct magazine *m, size_t cnt)
+{
+  lock_acquire (&d->lock);
+  for (; cnt > 0; cnt--)
+    {
+      enum intr_level old_level = intr_disable ();
+      struct block *b = magazine_pop (m);
+      intr_set_level (old_level);
+      if (b == NULL)
+        break;
+      release_block (d, b);
+    }
+  lock_release (&d->lock);
+}
+
+/* Flushes all of the running thread's magazines.  Called by
+   thread_exit() before the thread's page goes away. */
+void
+malloc_thread_exit (void)
+{
+  struct thread *t = thread_current ();
+  size_t i;
+
+  for (i = 0; i < desc_cnt; i++)
+    flush_magazine (&descs[i], &t->magazines[i], SIZE_MAX);
+}
+
+
+/* thread_foreach() callback that moves T's magazines onto the
+   RECLAIMED chains. */
+static void
+steal_magazines (struct thread *t, void *aux UNUSED)
+{
+  size_t i;
+
+  for (i = 0; i < desc_cnt; i++)
+    {
+      struct block *b;
+      while ((b = magazine_pop (&t->magazines[i])) != NULL)
+        magazine_push (&reclaimed[i], b);
+    }
+}
+
+/* Returns memory that malloc() holds but does not use to the
+   page allocator: empties every thread's magazines into the free
+   lists, which frees the arenas whose blocks were only held by
+   magazines.  Returns the number of pages freed. */
+size_t
+malloc_trim (void)
+{
+  enum intr_level old_level;
+  size_t freed = 0;
+  size_t i;
+
+  if (!lock_try_acquire (&reclaim_lock))
+    return 0;
+
+  old_level = intr_disable ();
+  thread_foreach (steal_magazines, NULL);
+  intr_set_level (old_level);
+
+  for (i = 0; i < desc_cnt; i++)
+    {
+      struct desc *d = &descs[i];
+      struct block *b;
+
+      lock_acquire (&d->lock);
+      while ((b = magazine_pop (&reclaimed[i])) != NULL)
+        if (release_block (d, b))
+          freed++;
+      lock_release (&d->lock);
+    }
+
+  lock_release (&reclaim_lock);
+  return freed;
+}
+
+/* Reclaimer for the kernel pool.  Trims malloc()'s unused
+   memory. */
+static size_t
+malloc_reclaim (enum palloc_flags flags, size_t page_cnt UNUSED)
+{
+  return flags & PAL_USER ? 0 : malloc_trim ();
+}
+
+/* Prints malloc() statistics: for each block size, the bytes in
+   use now and at peak, the number of blocks on the free list,
+   and the arenas held; then the bytes held by big blocks now and
+   at peak. */
+void
+malloc_print_stats (void)
+{
+  enum intr_level old_level = intr_disable ();
+  size_t i;
+
+  for (i = 0; i < desc_cnt; i++)
+    {
+      struct desc *d = &descs[i];
+      if (d->arena_cnt == 0 && d->peak_in_use == 0)
+        continue;
+      printf ("Malloc: %zu-byte blocks: %zu bytes in use (peak %zu), "
+              "%zu free blocks, %zu arenas\n",
+              d->block_size, d->in_use * d->block_size,
+              d->peak_in_use * d->block_size,
+              list_size (&d->free_list), d->arena_cnt);
+    }
+  printf ("Malloc: %zu big blocks using %zu bytes (peak %zu)\n",
+          big_cnt, big_pages * PGSIZE, peak_big_pages * PGSIZE);
+  intr_set_level (old_level);
+}
+
 /* Allocates and return A times B bytes initialized to zeroes.
    Returns a null pointer if memory is not available. */
 void *
@@ -167,7 +466,11 @@ calloc (size_t a, size_t b)
     return NULL;
 
   /* Allocate and zero memory. */
+#ifdef MALLOC_DEBUG
+  p = debug_malloc (size, __builtin_return_address (0));
+#else
   p = malloc (size);
+#endif
   if (p != NULL)
     memset (p, 0, size);
 
@@ -185,38 +488,71 @@ block_size (void *block)
   return d != NULL ? d->block_size : PGSIZE * a->free_cnt - pg_ofs (block);
 }
 
-/* Attempts to resize OLD_BLOCK to NEW_SIZE bytes, possibly
-   moving it in the process.
-   If successful, returns the new block; on failure, returns a
-   null pointer.
-   A call with null OLD_BLOCK is equivalent to malloc(NEW_SIZE).
-   A call with zero NEW_SIZE is equivalent to free(OLD_BLOCK). */
-void *
-realloc (void *old_block, size_t new_size) 
+/* Tries to make BLOCK hold NEW_SIZE bytes without moving it.
+   A small block stays put if NEW_SIZE still fits in it.  A big
+   block gives back pages it no longer needs, or takes the pages
+   that follow it if they are free, unless NEW_SIZE is small
+   enough for a descriptor, in which case copying it into a small
+   block saves memory.  Returns true if successful. */
+static bool
+resize_in_place (void *block, size_t new_size)
+{
+  struct arena *a = block_to_arena (block);
+  size_t old_cnt, new_cnt;
+  enum intr_level old_level;
+
+  if (a->desc != NULL)
+    return new_size <= a->desc->block_size;
+  if (new_size <= descs[desc_cnt - 1].block_size)
+    return false;
+
+  old_cnt = a->free_cnt;
+  new_cnt = DIV_ROUND_UP (new_size + sizeof *a, PGSIZE);
+  if (new_cnt < old_cnt)
+    palloc_free_multiple ((uint8_t *) a + PGSIZE * new_cnt, old_cnt - new_cnt);
+  else if (!palloc_extend_multiple (a, old_cnt, new_cnt))
+    return false;
+  a->free_cnt = new_cnt;
+
+  old_level = intr_disable ();
+  big_pages += new_cnt;
+  big_pages -= old_cnt;
+  if (big_pages > peak_big_pages)
+    peak_big_pages = big_pages;
+  intr_set_level (old_level);
+  return true;
+}
+
+/* Resizes OLD_BLOCK, which must have come from raw_malloc(), to
+   NEW_SIZE bytes, in place if it can.  Otherwise as realloc(). */
+static void *
+raw_realloc (void *old_block, size_t new_size)
 {
   if (new_size == 0) 
     {
-      free (old_block);
+      raw_free (old_block);
       return NULL;
     }
+  else if (old_block != NULL && resize_in_place (old_block, new_size))
+    return old_block;
   else 
     {
-      void *new_block = malloc (new_size);
+      void *new_block = raw_malloc (new_size);
       if (old_block != NULL && new_block != NULL)
         {
           size_t old_size = block_size (old_block);
           size_t min_size = new_size < old_size ? new_size : old_size;
           memcpy (new_block, old_block, min_size);
-          free (old_block);
+          raw_free (old_block);
         }
       return new_block;
     }
 }
 
 /* Frees block P, which must have been previously allocated with
-   malloc(), calloc(), or realloc(). */
-void
-free (void *p) 
+   raw_malloc() or raw_realloc(). */
+static void
+raw_free (void *p)
 {
   if (p != NULL)
     {
@@ -228,41 +564,342 @@ free (void *p)
         {
           /* It's a normal block.  We handle it here. */
 
+          struct magazine *m = &thread_current ()->magazines[d - descs];
+          enum intr_level old_level;
+          bool full;
+
 #ifndef NDEBUG
           /* Clear the block to help detect use-after-free bugs. */
           memset (b, 0xcc, d->block_size);
 #endif
-  
-          lock_acquire (&d->lock);
-
-          /* Add block to free list. */
-          list_push_front (&d->free_list, &b->free_elem);
-
-          /* If the arena is now entirely unused, free it. */
-          if (++a->free_cnt >= d->blocks_per_arena) 
-            {
-              size_t i;
-
-              ASSERT (a->free_cnt == d->blocks_per_arena);
-              for (i = 0; i < d->blocks_per_arena; i++) 
-                {
-                  struct block *b = arena_to_block (a, i);
-                  list_remove (&b->free_elem);
-                }
-              palloc_free_page (a);
-            }
-
-          lock_release (&d->lock);
+
+          /* Cache the block in the running thread's magazine.  If
+             that fills it, flush half of it to the free list. */
+          old_level = intr_disable ();
+          d->in_use--;
+          magazine_push (m, b);
+          full = m->cnt >= d->magazine_size;
+          intr_set_level (old_level);
+          if (full)
+            flush_magazine (d, m, d->magazine_size / 2);
         }
       else
         {
           /* It's a big block.  Free its pages. */
+          enum intr_level old_level = intr_disable ();
+          big_cnt--;
+          big_pages -= a->free_cnt;
+          intr_set_level (old_level);
+
           palloc_free_multiple (a, a->free_cnt);
           return;
         }
     }
 }
 
+/* Obtains and returns a new block of at least SIZE bytes.
+   Returns a null pointer if memory is not available. */
+void *
+malloc (size_t size)
+{
+#ifdef MALLOC_DEBUG
+  return debug_malloc (size, __builtin_return_address (0));
+#else
+  return raw_malloc (size);
+#endif
+}
+
+/* Attempts to resize OLD_BLOCK to NEW_SIZE bytes, possibly
+   moving it in the process.  The block is resized in place when
+   it can be, so the same pointer comes back.
+   If successful, returns the new block; on failure, returns a
+   null pointer.
+   A call with null OLD_BLOCK is equivalent to malloc(NEW_SIZE).
+   A call with zero NEW_SIZE is equivalent to free(OLD_BLOCK). */
+void *
+realloc (void *old_block, size_t new_size)
+{
+#ifdef MALLOC_DEBUG
+  return debug_realloc (old_block, new_size, __builtin_return_address (0));
+#else
+  return raw_realloc (old_block, new_size);
+#endif
+}
+
+/* Frees block P, which must have been previously allocated with
+   malloc(), calloc(), or realloc(). */
+void
+free (void *p)
+{
+#ifdef MALLOC_DEBUG
+  debug_free (p, __builtin_return_address (0));
+#else
+  raw_free (p);
+#endif
+}
+
+#ifdef MALLOC_DEBUG
+/* Debugging mode, compiled in only when MALLOC_DEBUG is defined
+   ("make MALLOC_DEBUG=1"), so that it costs nothing otherwise.
+
+   Each block is prefixed by a debug_header and surrounded on
+   both sides by REDZONE_SIZE bytes of REDZONE_BYTE, which free()
+   and realloc() check to catch writes past either end.  New
+   memory is filled with ALLOC_POISON and freed memory with
+   FREE_POISON.  A freed block waits in a small quarantine before
+   it goes back to the allocator; if its poison has changed by
+   the time it leaves, something wrote to it after it was freed.
+
+   The header also records the return address of the call that
+   allocated the block, and every live block is kept on a list,
+   so malloc_print_leaks() can report at shutdown which call
+   sites still hold memory.  Pass the "Call stack:" line it
+   prints to the `backtrace' utility to turn the addresses into
+   function names and line numbers.
+
+   The list and the quarantine are modified with interrupts off,
+   like the magazines. */
+
+#define DEBUG_MAGIC 0x6d64626c          /* Header of a live block. */
+#define DEBUG_FREED 0x6d646266          /* Header of a freed block. */
+#define REDZONE_SIZE 16                 /* Guard bytes on each side. */
+#define REDZONE_BYTE 0xfd               /* Value of guard bytes. */
+#define ALLOC_POISON 0xa5               /* Fill for new memory. */
+#define FREE_POISON 0xdd                /* Fill for freed memory. */
+#define QUARANTINE_CNT 64               /* Freed blocks held back. */
+#define LEAK_SITE_CNT 32                /* Call sites in a leak report. */
+
+/* Header in front of each block in debugging mode. */
+struct debug_header
+  {
+    unsigned magic;             /* DEBUG_MAGIC or DEBUG_FREED. */
+    size_t size;                /* Size requested by the caller. */
+    void *caller;               /* Where it was allocated. */
+    struct list_elem elem;      /* Element in live_blocks. */
+    uint8_t redzone[REDZONE_SIZE]; /* Guard bytes before the block. */
+  };
+
+static struct list live_blocks = LIST_INITIALIZER (live_blocks);
+static struct debug_header *quarantine[QUARANTINE_CNT];
+static size_t quarantine_next;
+
+/* Returns true if all SIZE bytes at P equal BYTE. */
+static bool
+is_filled (const uint8_t *p, uint8_t byte, size_t size)
+{
+  for (; size > 0; size--)
+    if (*p++ != byte)
+      return false;
+  return true;
+}
+
+/* Panics, naming WHO, if either redzone of the block with
+   header H has been written. */
+static void
+check_redzones (struct debug_header *h, const char *who)
+{
+  uint8_t *block = (uint8_t *) (h + 1);
+
+  if (!is_filled (h->redzone, REDZONE_BYTE, REDZONE_SIZE))
+    PANIC ("%s: write before %zu-byte block %p allocated at %p",
+           who, h->size, block, h->caller);
+  if (!is_filled (block + h->size, REDZONE_BYTE, REDZONE_SIZE))
+    PANIC ("%s: write past end of %zu-byte block %p allocated at %p",
+           who, h->size, block, h->caller);
+}
+
+/* Returns the header of block P, which WHO was called on from
+   CALLER.  Panics if P is not a live block or its redzones have
+   been written. */
+static struct debug_header *
+block_header (void *p, const char *who, void *caller)
+{
+  struct debug_header *h = (struct debug_header *) p - 1;
+
+  if (h->magic == DEBUG_FREED)
+    PANIC ("%s: block %p freed twice, the second time from %p",
+           who, p, caller);
+  if (h->magic != DEBUG_MAGIC)
+    PANIC ("%s: %p passed from %p is not a malloc() block",
+           who, p, caller);
+  check_redzones (h, who);
+  return h;
+}
+
+/* Returns the number of bytes needed for a SIZE-byte block with
+   its header and redzones, or 0 if that does not fit in
+   size_t. */
+static size_t
+debug_size (size_t size)
+{
+  size_t extra = sizeof (struct debug_header) + REDZONE_SIZE;
+  return size <= SIZE_MAX - extra ? size + extra : 0;
+}
+
+/* malloc() in debugging mode, called from CALLER. */
+static void *
+debug_malloc (size_t size, void *caller)
+{
+  struct debug_header *h;
+  uint8_t *block;
+  enum intr_level old_level;
+
+  if (size == 0 || debug_size (size) == 0)
+    return NULL;
+  h = raw_malloc (debug_size (size));
+  if (h == NULL)
+    return NULL;
+
+  block = (uint8_t *) (h + 1);
+  h->magic = DEBUG_MAGIC;
+  h->size = size;
+  h->caller = caller;
+  memset (h->redzone, REDZONE_BYTE, REDZONE_SIZE);
+  memset (block, ALLOC_POISON, size);
+  memset (block + size, REDZONE_BYTE, REDZONE_SIZE);
+
+  old_level = intr_disable ();
+  list_push_back (&live_blocks, &h->elem);
+  intr_set_level (old_level);
+  return block;
+}
+
+/* realloc() in debugging mode, called from CALLER.  The block
+   is resized by raw_realloc(), so it stays in place whenever the
+   normal allocator would keep it there. */
+static void *
+debug_realloc (void *old_block, size_t new_size, void *caller)
+{
+  struct debug_header *h, *new_h;
+  size_t old_size;
+  enum intr_level old_level;
+
+  if (old_block == NULL)
+    return debug_malloc (new_size, caller);
+  if (new_size == 0)
+    {
+      debug_free (old_block, caller);
+      return NULL;
+    }
+
+  h = block_header (old_block, "realloc", caller);
+  if (debug_size (new_size) == 0)
+    return NULL;
+  old_size = h->size;
+
+  old_level = intr_disable ();
+  list_remove (&h->elem);
+  intr_set_level (old_level);
+
+  new_h = raw_realloc (h, debug_size (new_size));
+  if (new_h != NULL)
+    {
+      uint8_t *block = (uint8_t *) (new_h + 1);
+      if (new_size > old_size)
+        memset (block + old_size, ALLOC_POISON, new_size - old_size);
+      memset (block + new_size, REDZONE_BYTE, REDZONE_SIZE);
+      new_h->size = new_size;
+      new_h->caller = caller;
+    }
+
+  old_level = intr_disable ();
+  list_push_back (&live_blocks, new_h != NULL ? &new_h->elem : &h->elem);
+  intr_set_level (old_level);
+  return new_h != NULL ? new_h + 1 : NULL;
+}
+
+/* free() in debugging mode, called from CALLER.  Poisons the
+   block and puts it in quarantine, and really frees the block
+   that has been in quarantine the longest. */
+static void
+debug_free (void *p, void *caller)
+{
+  struct debug_header *h, *old;
+  enum intr_level old_level;
+
+  if (p == NULL)
+    return;
+
+  h = block_header (p, "free", caller);
+  memset (p, FREE_POISON, h->size);
+
+  old_level = intr_disable ();
+  list_remove (&h->elem);
+  h->magic = DEBUG_FREED;
+  old = quarantine[quarantine_next];
+  quarantine[quarantine_next] = h;
+  quarantine_next = (quarantine_next + 1) % QUARANTINE_CNT;
+  intr_set_level (old_level);
+
+  if (old != NULL)
+    {
+      if (!is_filled ((uint8_t *) (old + 1), FREE_POISON, old->size))
+        PANIC ("free: %zu-byte block %p allocated at %p "
+               "was written after being freed",
+               old->size, old + 1, old->caller);
+      check_redzones (old, "free");
+      raw_free (old);
+    }
+}
+
+/* Prints the blocks that are still allocated, grouped by the
+   call site that allocated them, and then a "Call stack:" line
+   of those call sites for the `backtrace' utility. */
+void
+malloc_print_leaks (void)
+{
+  struct leak_site
+    {
+      void *caller;
+      size_t block_cnt;
+      size_t bytes;
+    }
+  sites[LEAK_SITE_CNT];
+  size_t site_cnt = 0;
+  size_t block_cnt = 0, bytes = 0;
+  struct list_elem *e;
+  enum intr_level old_level;
+  size_t i;
+
+  old_level = intr_disable ();
+  for (e = list_begin (&live_blocks); e != list_end (&live_blocks);
+       e = list_next (e))
+    {
+      struct debug_header *h = list_entry (e, struct debug_header, elem);
+
+      block_cnt++;
+      bytes += h->size;
+      for (i = 0; i < site_cnt; i++)
+        if (sites[i].caller == h->caller)
+          break;
+      if (i == site_cnt)
+        {
+          if (site_cnt == LEAK_SITE_CNT)
+            continue;
+          sites[site_cnt].caller = h->caller;
+          sites[site_cnt].block_cnt = 0;
+          sites[site_cnt].bytes = 0;
+          site_cnt++;
+        }
+      sites[i].block_cnt++;
+      sites[i].bytes += h->size;
+    }
+  intr_set_level (old_level);
+
+  printf ("Malloc: %zu blocks (%zu bytes) still allocated\n",
+          block_cnt, bytes);
+  if (site_cnt == 0)
+    return;
+  for (i = 0; i < site_cnt; i++)
+    printf ("Malloc:   %zu blocks (%zu bytes) from %p\n",
+            sites[i].block_cnt, sites[i].bytes, sites[i].caller);
+  printf ("Call stack:");
+  for (i = 0; i < site_cnt; i++)
+    printf (" %p", sites[i].caller);
+  printf (".\n");
+}
+#endif /* MALLOC_DEBUG */
+
 /* Returns the arena that block B is inside. */
 static struct arena *
 block_to_arena (struct block *b)
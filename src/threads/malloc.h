@@ -4,10 +4,29 @@
 #include <debug.h>
 #include <stddef.h>
 
+/* Number of block sizes that malloc() carves out of arenas
+   (16 bytes through 1 kB). */
+#define MALLOC_DESC_CNT 7
+
+/* A thread's private stack of free blocks of one size, which
+   malloc() and free() use before touching the shared free
+   lists.  See malloc.c. */
+struct magazine
+  {
+    void *top;                  /* Most recently cached block. */
+    size_t cnt;                 /* Number of blocks cached. */
+  };
+
 void malloc_init (void);
+void malloc_thread_exit (void);
 void *malloc (size_t) __attribute__ ((malloc));
 void *calloc (size_t, size_t) __attribute__ ((malloc));
 void *realloc (void *, size_t);
 void free (void *);
+size_t malloc_trim (void);
+void malloc_print_stats (void);
+#ifdef MALLOC_DEBUG
+void malloc_print_leaks (void);
+#endif
 
 #endif /* threads/malloc.h */
@@ -2,13 +2,14 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/loader.h"
-#include "threads/synch.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -22,23 +23,123 @@
    even if user processes are swapping like mad.
 
    By default, half of system RAM is given to the kernel pool and
-   half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   half to the user pool.  The boundary is soft, though: a pool
+   that runs dry borrows free pages from the other one, so that
+   a workload heavy on kernel caches can use idle user memory
+   and vice versa.  A pool lends only while more than its
+   reserve (a quarter of it) is free, which keeps the original
+   guarantee in a weaker form.  Borrowed pages go back to the
+   pool they came from when freed; when a pool that has pages
+   out on loan runs dry, it asks the borrowing side's reclaimers
+   to shrink their caches.  With -ul the user pool never
+   borrows, so that the limit still holds.
+
+   Within a pool, free pages are kept by a buddy allocator.  A
+   free block of order K is 2**K pages long and starts at a page
+   index (relative to the pool base) that is a multiple of 2**K.
+   Its "buddy" is the block of the same order at the index with
+   bit K flipped.  Allocation splits a larger block when no block
+   of the right order is free, and freeing merges a block with
+   its buddy for as long as the buddy is free too, so both take
+   O(MAX_ORDER) steps.  Runs that are not a power of two long are
+   handed out by allocating the next larger block and freeing its
+   tail right away.
+
+   Single pages, which are most of the traffic (user frames,
+   thread stacks, page tables), go through a small "hot" cache
+   in front of each pool instead.  A freed page is pushed on the
+   cache and the next request pops the most recently freed one,
+   which is likely still in the CPU cache, without touching the
+   buddy lists or the bitmap.  An empty cache is refilled with
+   HOT_BATCH pages at once and a full one gives its HOT_BATCH
+   oldest pages back, so the buddy allocator is only reached
+   once per batch.  Pages in the cache stay marked in use.
+
+   A pool is modified with interrupts turned off rather than
+   under a lock, because thread_schedule_tail() frees the pages
+   of a dying thread from inside the scheduler.  On this
+   uniprocessor kernel that also makes the hot cache the
+   equivalent of a per-CPU page list. */
+
+/* Number of pages per pool that the idle thread keeps zeroed
+   ahead of time, so that PAL_ZERO requests for a single page can
+   skip the memset. */
+#define ZEROED_MAX 16
+
+/* Pages each pool's hot cache holds at most, and the number it
+   takes from or gives back to the buddy allocator at a time. */
+#define HOT_MAX 32
+#define HOT_BATCH 8
+
+/* Largest block order: 2**MAX_ORDER pages (16 MB). */
+#define MAX_ORDER 12
+
+/* Value of a pool's ORDERS entry for a page that does not start
+   a free block. */
+#define NOT_FREE 0xff
+
+/* Value of a pool's ORDERS entry for an allocated page that was
+   lent to the other pool's class. */
+#define LENT 0xfe
+
+/* A pool keeps 1/RESERVE_DIV of its pages back from the other
+   class. */
+#define RESERVE_DIV 4
 
 /* A memory pool. */
 struct pool
   {
-    struct lock lock;                   /* Mutual exclusion. */
+    const char *name;                   /* Name, for statistics. */
     struct bitmap *used_map;            /* Bitmap of free pages. */
+    uint8_t *orders;                    /* Order of the free block
+                                           starting at each page. */
+    struct list free_lists[MAX_ORDER + 1]; /* Free blocks by order. */
+    size_t free_cnts[MAX_ORDER + 1];    /* Length of each list. */
+    size_t free_pages;                  /* Pages in free blocks. */
+    void *zeroed[ZEROED_MAX];           /* Allocated pages known
+                                           to be all zeros. */
+    size_t zeroed_cnt;                  /* Number of ZEROED pages. */
+    void *hot[HOT_MAX];                 /* Free pages kept out of the
+                                           buddy allocator, most
+                                           recently freed last. */
+    size_t hot_cnt;                     /* Number of HOT pages. */
+    struct pool *lender;                /* Pool to borrow from, or
+                                           null. */
+    size_t reserve;                     /* Free pages not lent. */
+    size_t lent;                        /* Pages lent out now. */
     uint8_t *base;                      /* Base of pool. */
   };
 
+/* Header kept in the first page of each free block. */
+struct free_block
+  {
+    struct list_elem elem;              /* Element in a free list. */
+  };
+
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
+/* Callbacks that give cached pages back when a pool runs dry.
+   Subsystems that keep pages around only as a cache register
+   one here, so the cache may grow while memory is plentiful. */
+#define RECLAIMER_MAX 8
+static palloc_reclaim_func *reclaimers[RECLAIMER_MAX];
+static size_t reclaimer_cnt;
+
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static size_t reclaim_pages (enum palloc_flags, size_t page_cnt);
+static size_t buddy_alloc (struct pool *, size_t page_cnt);
+static void buddy_free (struct pool *, size_t page_idx, size_t page_cnt);
+static void buddy_take (struct pool *, size_t page_idx, size_t page_cnt);
+static void *pool_alloc (struct pool *, size_t page_cnt);
+static bool pool_can_lend (const struct pool *, size_t page_cnt);
+static void *pool_lend (struct pool *, size_t page_cnt);
+static void return_lent (struct pool *, size_t page_idx, size_t page_cnt);
+static void *take_hot_page (struct pool *);
+static void put_hot_page (struct pool *, void *page);
+static size_t reclaim_cached (enum palloc_flags, size_t page_cnt);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -59,32 +160,58 @@ palloc_init (size_t user_page_limit)
   init_pool (&kernel_pool, free_start, kernel_pages, "kernel pool");
   init_pool (&user_pool, free_start + kernel_pages * PGSIZE,
              user_pages, "user pool");
+  kernel_pool.lender = &user_pool;
+  user_pool.lender = user_page_limit == SIZE_MAX ? &kernel_pool : NULL;
+  palloc_register_reclaimer (reclaim_cached);
+}
+
+/* Registers RECLAIM to be called before an allocation fails.
+   Intended to be called during initialization. */
+void
+palloc_register_reclaimer (palloc_reclaim_func *reclaim)
+{
+  ASSERT (reclaimer_cnt < RECLAIMER_MAX);
+  reclaimers[reclaimer_cnt++] = reclaim;
 }
 
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
    If PAL_USER is set, the pages are obtained from the user pool,
    otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
    then the pages are filled with zeros.  If too few pages are
-   available, returns a null pointer, unless PAL_ASSERT is set in
-   FLAGS, in which case the kernel panics. */
+   available, they are borrowed from the other pool if it can
+   spare them; failing that, the registered reclaimers are asked
+   to free some and the allocation is retried for as long as
+   they make progress.
+   If that fails too, returns a null pointer, unless PAL_ASSERT
+   is set in FLAGS, in which case the kernel panics. */
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 {
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
   void *pages;
-  size_t page_idx;
 
   if (page_cnt == 0)
     return NULL;
 
-  lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-  lock_release (&pool->lock);
+  /* A single zeroed page may already be waiting. */
+  if (page_cnt == 1 && (flags & PAL_ZERO))
+    {
+      enum intr_level old_level = intr_disable ();
+      pages = pool->zeroed_cnt > 0 ? pool->zeroed[--pool->zeroed_cnt] : NULL;
+      intr_set_level (old_level);
+      if (pages != NULL)
+        return pages;
+    }
 
-  if (page_idx != BITMAP_ERROR)
-    pages = pool->base + PGSIZE * page_idx;
-  else
-    pages = NULL;
+  do
+    {
+      enum intr_level old_level = intr_disable ();
+      pages = pool_alloc (pool, page_cnt);
+      if (pages == NULL && pool->lender != NULL)
+        pages = pool_lend (pool->lender, page_cnt);
+      intr_set_level (old_level);
+    }
+  while (pages == NULL && reclaim_pages (flags, page_cnt) > 0);
 
   if (pages != NULL) 
     {
@@ -119,6 +246,7 @@ palloc_free_multiple (void *pages, size_t page_cnt)
 {
   struct pool *pool;
   size_t page_idx;
+  enum intr_level old_level;
 
   ASSERT (pg_ofs (pages) == 0);
   if (pages == NULL || page_cnt == 0)
@@ -137,8 +265,13 @@ palloc_free_multiple (void *pages, size_t page_cnt)
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
-  ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
-  bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  old_level = intr_disable ();
+  return_lent (pool, page_idx, page_cnt);
+  if (page_cnt == 1)
+    put_hot_page (pool, pages);
+  else
+    buddy_free (pool, page_idx, page_cnt);
+  intr_set_level (old_level);
 }
 
 /* Frees the page at PAGE. */
@@ -148,15 +281,512 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Tries to grow the PAGE_CNT pages starting at PAGES, which must
+   have been obtained from palloc_get_multiple(), to NEW_CNT
+   pages by taking the pages that follow them.  Returns true if
+   successful.  Returns false, leaving the pages as they were, if
+   any of the following pages is in use or past the end of the
+   pool, or if the pages are on loan and their pool cannot spare
+   more of them.  The new pages are not zeroed. */
+bool
+palloc_extend_multiple (void *pages, size_t page_cnt, size_t new_cnt)
+{
+  struct pool *pool;
+  size_t page_idx;
+  enum intr_level old_level;
+  bool lent, success;
+
+  ASSERT (pg_ofs (pages) == 0);
+  ASSERT (page_cnt > 0);
+  if (new_cnt <= page_cnt)
+    return true;
+
+  if (page_from_pool (&kernel_pool, pages))
+    pool = &kernel_pool;
+  else if (page_from_pool (&user_pool, pages))
+    pool = &user_pool;
+  else
+    NOT_REACHED ();
+
+  page_idx = pg_no (pages) - pg_no (pool->base) + page_cnt;
+  new_cnt -= page_cnt;
+  if (page_idx + new_cnt > bitmap_size (pool->used_map))
+    return false;
+
+  old_level = intr_disable ();
+  lent = pool->orders[page_idx - 1] == LENT;
+  success = (bitmap_none (pool->used_map, page_idx, new_cnt)
+             && (!lent || pool_can_lend (pool, new_cnt)));
+  if (success)
+    {
+      buddy_take (pool, page_idx, new_cnt);
+
+      /* The new pages are on loan if the old ones are. */
+      if (lent)
+        {
+          memset (pool->orders + page_idx, LENT, new_cnt);
+          pool->lent += new_cnt;
+        }
+    }
+  intr_set_level (old_level);
+  return success;
+}
+
+/* Takes a free page from the pool with fewer zeroed pages
+   waiting, clears it, and adds it to that pool's zeroed pages.
+   If that pool is full or has no free page, the other pool is
+   tried instead, so that both fill up to ZEROED_MAX.  Returns
+   false if there was nothing to do.  Called by the idle thread
+   with interrupts on, so that the memset happens while the CPU
+   would otherwise be halted. */
+bool
+palloc_zero_free_page (void)
+{
+  struct pool *pools[2];
+  struct pool *pool = NULL;
+  enum intr_level old_level;
+  size_t page_idx = BITMAP_ERROR;
+  void *page;
+  int i;
+
+  if (user_pool.zeroed_cnt <= kernel_pool.zeroed_cnt)
+    {
+      pools[0] = &user_pool;
+      pools[1] = &kernel_pool;
+    }
+  else
+    {
+      pools[0] = &kernel_pool;
+      pools[1] = &user_pool;
+    }
+
+  for (i = 0; i < 2 && page_idx == BITMAP_ERROR; i++)
+    {
+      pool = pools[i];
+      if (pool->zeroed_cnt >= ZEROED_MAX)
+        continue;
+
+      old_level = intr_disable ();
+      page_idx = buddy_alloc (pool, 1);
+      intr_set_level (old_level);
+    }
+  if (page_idx == BITMAP_ERROR)
+    return false;
+
+  page = pool->base + PGSIZE * page_idx;
+  memset (page, 0, PGSIZE);
+
+  old_level = intr_disable ();
+  if (pool->zeroed_cnt < ZEROED_MAX)
+    pool->zeroed[pool->zeroed_cnt++] = page;
+  else
+    buddy_free (pool, page_idx, 1);
+  intr_set_level (old_level);
+  return true;
+}
+
+/* Returns true if PAGE, which must be allocated, came from the
+   other pool than its class's own, that is, if it is on loan. */
+bool
+palloc_page_lent (void *page)
+{
+  struct pool *pool;
+
+  if (page_from_pool (&kernel_pool, page))
+    pool = &kernel_pool;
+  else if (page_from_pool (&user_pool, page))
+    pool = &user_pool;
+  else
+    NOT_REACHED ();
+  return pool->orders[pg_no (page) - pg_no (pool->base)] == LENT;
+}
+
+/* Stores in *BASE and *PAGE_CNT the range of pages that
+   palloc_get_page (PAL_USER) can return.  Because the user pool
+   may borrow from the kernel pool, this spans both pools (and
+   the user pool's bitmap between them). */
+void
+palloc_user_pool_range (void **base, size_t *page_cnt)
+{
+  *base = kernel_pool.base;
+  *page_cnt = (pg_no (user_pool.base) + bitmap_size (user_pool.used_map)
+               - pg_no (kernel_pool.base));
+}
+
+/* Prints the free pages of POOL, broken down by block order. */
+static void
+print_pool_stats (const struct pool *pool)
+{
+  int order;
+
+  printf ("%s: ", pool->name);
+  for (order = 0; order <= MAX_ORDER; order++)
+    if (pool->free_cnts[order] != 0)
+      printf ("%zu*%d ", pool->free_cnts[order], 1 << order);
+  printf ("(%zu of %zu pages free, %zu zeroed, %zu hot, %zu lent)\n",
+          pool->free_pages, bitmap_size (pool->used_map), pool->zeroed_cnt,
+          pool->hot_cnt, pool->lent);
+}
+
+/* Prints page allocator statistics. */
+void
+palloc_print_stats (void)
+{
+  enum intr_level old_level = intr_disable ();
+  print_pool_stats (&kernel_pool);
+  print_pool_stats (&user_pool);
+  intr_set_level (old_level);
+}
+
+/* Returns the smallest order whose blocks hold PAGE_CNT pages. */
+static int
+block_order (size_t page_cnt)
+{
+  int order = 0;
+  while (((size_t) 1 << order) < page_cnt)
+    order++;
+  return order;
+}
+
+/* Adds the block of ORDER starting at PAGE_IDX to POOL's free
+   lists. */
+static void
+push_block (struct pool *pool, size_t page_idx, int order)
+{
+  struct free_block *fb = (struct free_block *) (pool->base
+                                                 + PGSIZE * page_idx);
+  pool->orders[page_idx] = order;
+  list_push_front (&pool->free_lists[order], &fb->elem);
+  pool->free_cnts[order]++;
+  pool->free_pages += (size_t) 1 << order;
+}
+
+/* Removes the free block starting at PAGE_IDX from POOL's free
+   lists. */
+static void
+remove_block (struct pool *pool, size_t page_idx)
+{
+  struct free_block *fb = (struct free_block *) (pool->base
+                                                 + PGSIZE * page_idx);
+  int order = pool->orders[page_idx];
+
+  ASSERT (order != NOT_FREE);
+  list_remove (&fb->elem);
+  pool->free_cnts[order]--;
+  pool->free_pages -= (size_t) 1 << order;
+  pool->orders[page_idx] = NOT_FREE;
+}
+
+/* Frees the block of ORDER starting at PAGE_IDX in POOL, merging
+   it with its buddy for as long as the buddy is free. */
+static void
+free_block (struct pool *pool, size_t page_idx, int order)
+{
+  while (order < MAX_ORDER)
+    {
+      size_t buddy = page_idx ^ ((size_t) 1 << order);
+      if (buddy >= bitmap_size (pool->used_map)
+          || pool->orders[buddy] != order)
+        break;
+      remove_block (pool, buddy);
+      if (buddy < page_idx)
+        page_idx = buddy;
+      order++;
+    }
+  push_block (pool, page_idx, order);
+}
+
+/* Frees the PAGE_CNT pages starting at PAGE_IDX in POOL, as the
+   largest aligned blocks that cover them. */
+static void
+free_run (struct pool *pool, size_t page_idx, size_t page_cnt)
+{
+  while (page_cnt > 0)
+    {
+      int order = 0;
+      while (order < MAX_ORDER
+             && page_idx % ((size_t) 2 << order) == 0
+             && ((size_t) 2 << order) <= page_cnt)
+        order++;
+      free_block (pool, page_idx, order);
+      page_idx += (size_t) 1 << order;
+      page_cnt -= (size_t) 1 << order;
+    }
+}
+
+/* Allocates PAGE_CNT contiguous pages from POOL and returns the
+   index of the first, or BITMAP_ERROR if no free block is large
+   enough.  Interrupts must be off. */
+static size_t
+buddy_alloc (struct pool *pool, size_t page_cnt)
+{
+  int want = block_order (page_cnt);
+  int order;
+  struct free_block *fb;
+  size_t page_idx;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (want > MAX_ORDER)
+    return BITMAP_ERROR;
+  for (order = want; order <= MAX_ORDER; order++)
+    if (!list_empty (&pool->free_lists[order]))
+      break;
+  if (order > MAX_ORDER)
+    return BITMAP_ERROR;
+
+  fb = list_entry (list_front (&pool->free_lists[order]),
+                   struct free_block, elem);
+  page_idx = ((uint8_t *) fb - pool->base) / PGSIZE;
+  remove_block (pool, page_idx);
+
+  /* Split off the upper halves that are not needed. */
+  while (order > want)
+    {
+      order--;
+      push_block (pool, page_idx + ((size_t) 1 << order), order);
+    }
+
+  /* Give back the tail of a block that is longer than asked. */
+  if (((size_t) 1 << want) > page_cnt)
+    free_run (pool, page_idx + page_cnt, ((size_t) 1 << want) - page_cnt);
+
+  ASSERT (bitmap_none (pool->used_map, page_idx, page_cnt));
+  bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+  return page_idx;
+}
+
+/* Returns the PAGE_CNT pages starting at PAGE_IDX to POOL.
+   Interrupts must be off. */
+static void
+buddy_free (struct pool *pool, size_t page_idx, size_t page_cnt)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
+
+  bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  free_run (pool, page_idx, page_cnt);
+}
+
+/* Allocates the PAGE_CNT free pages starting at PAGE_IDX in
+   POOL.  Each free block that overlaps them is taken off its
+   list and whatever part of it lies outside the range is freed
+   again.  Interrupts must be off. */
+static void
+buddy_take (struct pool *pool, size_t page_idx, size_t page_cnt)
+{
+  size_t end = page_idx + page_cnt;
+  size_t i = page_idx;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (bitmap_none (pool->used_map, page_idx, page_cnt));
+
+  while (i < end)
+    {
+      size_t head = i, block_end;
+      int order;
+
+      /* Find the free block that contains page I. */
+      for (order = 0; order <= MAX_ORDER; order++)
+        {
+          head = i & ~(((size_t) 1 << order) - 1);
+          if (pool->orders[head] == order)
+            break;
+        }
+      ASSERT (order <= MAX_ORDER);
+      block_end = head + ((size_t) 1 << order);
+
+      remove_block (pool, head);
+      free_run (pool, head, i - head);
+      if (block_end > end)
+        {
+          free_run (pool, end, block_end - end);
+          block_end = end;
+        }
+      i = block_end;
+    }
+
+  bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+}
+
+/* Allocates PAGE_CNT pages from POOL, a single page by way of
+   its hot cache.  Returns a null pointer if POOL has no run of
+   PAGE_CNT free pages.  Interrupts must be off. */
+static void *
+pool_alloc (struct pool *pool, size_t page_cnt)
+{
+  size_t page_idx;
+
+  if (page_cnt == 1)
+    return take_hot_page (pool);
+  page_idx = buddy_alloc (pool, page_cnt);
+  return page_idx != BITMAP_ERROR ? pool->base + PGSIZE * page_idx : NULL;
+}
+
+/* Returns true if POOL has PAGE_CNT free pages above its
+   reserve to lend to the other pool's class.  Zeroed pages are
+   held back for POOL's own PAL_ZERO requests and do not count.
+   Interrupts must be off. */
+static bool
+pool_can_lend (const struct pool *pool, size_t page_cnt)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  return pool->free_pages + pool->hot_cnt >= pool->reserve + page_cnt;
+}
+
+/* Allocates PAGE_CNT pages from POOL for the other pool's class,
+   if POOL has that many free pages above its reserve, and marks
+   them lent.  Returns a null pointer otherwise.  Interrupts must
+   be off. */
+static void *
+pool_lend (struct pool *pool, size_t page_cnt)
+{
+  uint8_t *pages;
+
+  if (!pool_can_lend (pool, page_cnt))
+    return NULL;
+  pages = pool_alloc (pool, page_cnt);
+  if (pages != NULL)
+    {
+      memset (pool->orders + (pages - pool->base) / PGSIZE, LENT, page_cnt);
+      pool->lent += page_cnt;
+    }
+  return pages;
+}
+
+/* Clears the lent mark of any of the PAGE_CNT pages starting at
+   PAGE_IDX in POOL, which are being freed.  Interrupts must be
+   off. */
+static void
+return_lent (struct pool *pool, size_t page_idx, size_t page_cnt)
+{
+  size_t i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (i = page_idx; i < page_idx + page_cnt; i++)
+    if (pool->orders[i] == LENT)
+      {
+        pool->orders[i] = NOT_FREE;
+        pool->lent--;
+      }
+}
+
+/* Pops a page off POOL's hot cache and returns it, refilling
+   the cache from the buddy allocator first if it is empty.
+   Returns a null pointer if POOL has no free page.  Interrupts
+   must be off. */
+static void *
+take_hot_page (struct pool *pool)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (pool->hot_cnt == 0)
+    {
+      /* Take a whole block if there is one, so that one split
+         serves the batch; otherwise scrape up single pages. */
+      size_t page_idx = buddy_alloc (pool, HOT_BATCH);
+      if (page_idx != BITMAP_ERROR)
+        {
+          size_t i;
+          for (i = HOT_BATCH; i-- > 0; )
+            pool->hot[pool->hot_cnt++] = pool->base + PGSIZE * (page_idx + i);
+        }
+      else
+        while (pool->hot_cnt < HOT_BATCH
+               && (page_idx = buddy_alloc (pool, 1)) != BITMAP_ERROR)
+          pool->hot[pool->hot_cnt++] = pool->base + PGSIZE * page_idx;
+      if (pool->hot_cnt == 0)
+        return NULL;
+    }
+  return pool->hot[--pool->hot_cnt];
+}
+
+/* Gives back to POOL's buddy allocator the CNT pages that have
+   been in its hot cache the longest.  Interrupts must be off. */
+static void
+drain_hot_pages (struct pool *pool, size_t cnt)
+{
+  size_t i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (cnt <= pool->hot_cnt);
+
+  for (i = 0; i < cnt; i++)
+    {
+      uint8_t *page = pool->hot[i];
+      buddy_free (pool, (page - pool->base) / PGSIZE, 1);
+    }
+  pool->hot_cnt -= cnt;
+  memmove (pool->hot, pool->hot + cnt, pool->hot_cnt * sizeof *pool->hot);
+}
+
+/* Pushes PAGE, which belongs to POOL, on POOL's hot cache,
+   draining the cache first if it is full.  Interrupts must be
+   off. */
+static void
+put_hot_page (struct pool *pool, void *page)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (pool->hot_cnt == HOT_MAX)
+    drain_hot_pages (pool, HOT_BATCH);
+  pool->hot[pool->hot_cnt++] = page;
+}
+
+/* Reclaimer that gives the zeroed and hot pages of the pool
+   selected by FLAGS back to the buddy allocator, where they can
+   merge into larger blocks.  They are cheap to make again, so
+   all of them go at once. */
+static size_t
+reclaim_cached (enum palloc_flags flags, size_t page_cnt UNUSED)
+{
+  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  enum intr_level old_level = intr_disable ();
+  size_t freed = pool->zeroed_cnt + pool->hot_cnt;
+
+  while (pool->zeroed_cnt > 0)
+    {
+      uint8_t *page = pool->zeroed[--pool->zeroed_cnt];
+      buddy_free (pool, (page - pool->base) / PGSIZE, 1);
+    }
+  drain_hot_pages (pool, pool->hot_cnt);
+  intr_set_level (old_level);
+  return freed;
+}
+
+/* Asks every reclaimer to free pages of the pool selected by
+   FLAGS.  If none could and that pool has pages out on loan,
+   asks them again on behalf of the other pool, with PAL_LENT,
+   since that is whose caches hold the loaned pages.  Returns the
+   total number of pages freed. */
+static size_t
+reclaim_pages (enum palloc_flags flags, size_t page_cnt)
+{
+  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  size_t freed = 0;
+  size_t i;
+
+  for (i = 0; i < reclaimer_cnt; i++)
+    freed += reclaimers[i] (flags, page_cnt);
+  if (freed == 0 && pool->lent > 0)
+    for (i = 0; i < reclaimer_cnt; i++)
+      freed += reclaimers[i] ((flags ^ PAL_USER) | PAL_LENT, page_cnt);
+  return freed;
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
 init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
+  /* We'll put the pool's used_map and the order of each page at
+     its base.  Calculate the space needed for them and subtract
+     it from the pool's size. */
+  size_t bm_size = bitmap_buf_size (page_cnt);
+  size_t bm_pages = DIV_ROUND_UP (bm_size + page_cnt, PGSIZE);
+  int order;
   if (bm_pages > page_cnt)
     PANIC ("Not enough memory in %s for bitmap.", name);
   page_cnt -= bm_pages;
@@ -164,9 +794,23 @@ init_pool (struct pool *p, void *base, size_t page_cnt, const char *name)
   printf ("%zu pages available in %s.\n", page_cnt, name);
 
   /* Initialize the pool. */
-  lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
+  p->name = name;
+  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_size);
+  p->orders = (uint8_t *) base + bm_size;
+  memset (p->orders, NOT_FREE, page_cnt);
+  for (order = 0; order <= MAX_ORDER; order++)
+    {
+      list_init (&p->free_lists[order]);
+      p->free_cnts[order] = 0;
+    }
+  p->free_pages = 0;
+  p->zeroed_cnt = 0;
+  p->hot_cnt = 0;
+  p->lender = NULL;
+  p->reserve = page_cnt / RESERVE_DIV;
+  p->lent = 0;
   p->base = base + bm_pages * PGSIZE;
+  free_run (p, 0, page_cnt);
 }
 
 /* Returns true if PAGE was allocated from POOL,
@@ -1,6 +1,7 @@
 #ifndef THREADS_PALLOC_H
 #define THREADS_PALLOC_H
 
+#include <stdbool.h>
 #include <stddef.h>
 
 /* How to allocate pages. */
@@ -8,13 +9,33 @@ enum palloc_flags
   {
     PAL_ASSERT = 001,           /* Panic on failure. */
     PAL_ZERO = 002,             /* Zero page contents. */
-    PAL_USER = 004              /* User page. */
+    PAL_USER = 004,             /* User page. */
+    PAL_LENT = 010              /* Reclaim only: pages lent to the
+                                   other pool's class. */
   };
 
+/* A reclaim callback.  Called when a pool cannot satisfy a
+   request for PAGE_CNT pages; FLAGS tells which pool (PAL_USER
+   or not).  Should give cached pages of that pool back with
+   palloc_free_page() and return how many it freed, or 0 if it
+   has nothing to give.  Since the pools lend each other pages,
+   it may also be called for its pool on behalf of the other
+   one, with PAL_LENT set in FLAGS; then only pages for which
+   palloc_page_lent() is true help, and only those should be
+   counted.  Must not allocate pages. */
+typedef size_t palloc_reclaim_func (enum palloc_flags flags,
+                                    size_t page_cnt);
+
 void palloc_init (size_t user_page_limit);
+void palloc_register_reclaimer (palloc_reclaim_func *);
 void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+bool palloc_extend_multiple (void *, size_t page_cnt, size_t new_cnt);
+bool palloc_zero_free_page (void);
+bool palloc_page_lent (void *);
+void palloc_user_pool_range (void **base, size_t *page_cnt);
+void palloc_print_stats (void);
 
 #endif /* threads/palloc.h */
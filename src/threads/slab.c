@@ -0,0 +1,264 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Object caches.
+
+   A cache hands out objects of exactly one size from "slabs",
+   pages divided into as many objects as fit after a header.  A
+   40-byte structure therefore takes 40 bytes instead of the 64
+   that malloc() would round it up to, and allocation does not
+   search for a size class.
+
+   The header of each slab holds a stack of the indexes of its
+   free objects.  Keeping the free list out of the objects means
+   that an object keeps whatever its constructor put in it while
+   it is free, so a constructor runs only once per object, when
+   its slab is created.
+
+   A cache keeps the slabs that have free objects on its PARTIAL
+   list.  Full slabs are on no list; like malloc()'s arenas, a
+   slab is found from any of its objects by rounding the object's
+   address down to a page boundary.  When a slab becomes entirely
+   free it is given back to the page allocator, except that each
+   cache keeps one empty slab so that an object allocated and
+   freed over and over does not cost a page each time.  The
+   kernel pool's reclaimer frees those empty slabs. */
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* A slab: one page of objects belonging to a cache. */
+struct slab
+  {
+    unsigned magic;             /* Always set to SLAB_MAGIC. */
+    struct kmem_cache *cache;   /* Owning cache. */
+    struct list_elem elem;      /* Element in the cache's PARTIAL list. */
+    size_t free_cnt;            /* Number of free objects. */
+    uint16_t free_idx[];        /* Indexes of the free objects. */
+  };
+
+/* All caches, for reclaim and statistics. */
+static struct list all_caches;
+
+static size_t kmem_reclaim (enum palloc_flags, size_t page_cnt);
+
+/* Initializes the object cache allocator. */
+void
+slab_init (void) 
+{
+  list_init (&all_caches);
+  palloc_register_reclaimer (kmem_reclaim);
+}
+
+/* Initializes C as a cache of SIZE-byte objects, named NAME for
+   statistics.  If CTOR is nonnull, it is run on every object
+   when the object's slab is created. */
+void
+kmem_cache_init (struct kmem_cache *c, const char *name, size_t size,
+                 kmem_ctor_func *ctor) 
+{
+  enum intr_level old_level;
+
+  ASSERT (size > 0);
+
+  c->name = name;
+  c->obj_size = ROUND_UP (size, sizeof (void *));
+
+  /* Leave room for the free index of each object and for
+     aligning the first object. */
+  c->objs_per_slab = (PGSIZE - sizeof (struct slab) - sizeof (void *))
+                     / (c->obj_size + sizeof (uint16_t));
+  ASSERT (c->objs_per_slab > 0);
+  c->objs_ofs = ROUND_UP (sizeof (struct slab)
+                          + c->objs_per_slab * sizeof (uint16_t),
+                          sizeof (void *));
+  ASSERT (c->objs_ofs + c->objs_per_slab * c->obj_size <= PGSIZE);
+  c->ctor = ctor;
+
+  lock_init (&c->lock);
+  list_init (&c->partial);
+  c->empty = NULL;
+  c->slab_cnt = 0;
+  c->in_use = 0;
+  c->peak_in_use = 0;
+  c->alloc_cnt = 0;
+
+  old_level = intr_disable ();
+  list_push_back (&all_caches, &c->elem);
+  intr_set_level (old_level);
+}
+
+/* Returns the object numbered IDX in slab S of cache C. */
+static void *
+slab_obj (const struct kmem_cache *c, struct slab *s, size_t idx) 
+{
+  return (uint8_t *) s + c->objs_ofs + idx * c->obj_size;
+}
+
+/* Allocates a page and makes it a slab of cache C, with every
+   object free and constructed.  Returns a null pointer if no
+   page is available.  Must be called without C's lock, so that
+   palloc's reclaimers may take it. */
+static struct slab *
+slab_create (struct kmem_cache *c) 
+{
+  struct slab *s = palloc_get_page (0);
+  size_t i;
+
+  if (s == NULL)
+    return NULL;
+
+  s->magic = SLAB_MAGIC;
+  s->cache = c;
+  s->free_cnt = c->objs_per_slab;
+  for (i = 0; i < c->objs_per_slab; i++) 
+    {
+      /* Hand out the lowest addresses first. */
+      s->free_idx[i] = c->objs_per_slab - 1 - i;
+      if (c->ctor != NULL)
+        c->ctor (slab_obj (c, s, i));
+    }
+  return s;
+}
+
+/* Gives slab S of cache C, which must be empty and on C's
+   PARTIAL list, back to the page allocator.  C's lock must be
+   held. */
+static void
+slab_destroy (struct kmem_cache *c, struct slab *s) 
+{
+  ASSERT (s->free_cnt == c->objs_per_slab);
+
+  list_remove (&s->elem);
+  if (c->empty == s)
+    c->empty = NULL;
+  c->slab_cnt--;
+  palloc_free_page (s);
+}
+
+/* Returns an object from cache C, or a null pointer if memory is
+   not available.  The object is in the state that its
+   constructor, or the last user to free it, left it in. */
+void *
+kmem_cache_alloc (struct kmem_cache *c) 
+{
+  struct slab *s;
+  void *obj;
+
+  lock_acquire (&c->lock);
+  if (list_empty (&c->partial)) 
+    {
+      lock_release (&c->lock);
+      s = slab_create (c);
+      if (s == NULL)
+        return NULL;
+      lock_acquire (&c->lock);
+      list_push_front (&c->partial, &s->elem);
+      c->slab_cnt++;
+    }
+
+  /* The empty slab is kept at the back, so it is used only when
+     no partly used slab is left. */
+  s = list_entry (list_front (&c->partial), struct slab, elem);
+  if (c->empty == s)
+    c->empty = NULL;
+  obj = slab_obj (c, s, s->free_idx[--s->free_cnt]);
+  if (s->free_cnt == 0)
+    list_remove (&s->elem);
+
+  if (++c->in_use > c->peak_in_use)
+    c->peak_in_use = c->in_use;
+  c->alloc_cnt++;
+  lock_release (&c->lock);
+  return obj;
+}
+
+/* Returns OBJ, which must have come from kmem_cache_alloc(C), to
+   cache C.  Does nothing if OBJ is a null pointer. */
+void
+kmem_cache_free (struct kmem_cache *c, void *obj) 
+{
+  struct slab *s;
+  size_t ofs;
+
+  if (obj == NULL)
+    return;
+
+  s = pg_round_down (obj);
+  ofs = pg_ofs (obj);
+  ASSERT (s->magic == SLAB_MAGIC);
+  ASSERT (s->cache == c);
+  ASSERT (ofs >= c->objs_ofs && (ofs - c->objs_ofs) % c->obj_size == 0);
+
+  lock_acquire (&c->lock);
+  ASSERT (s->free_cnt < c->objs_per_slab);
+  if (s->free_cnt == 0)
+    list_push_front (&c->partial, &s->elem);
+  s->free_idx[s->free_cnt++] = (ofs - c->objs_ofs) / c->obj_size;
+  c->in_use--;
+
+  if (s->free_cnt == c->objs_per_slab) 
+    {
+      if (c->empty == NULL) 
+        {
+          c->empty = s;
+          list_remove (&s->elem);
+          list_push_back (&c->partial, &s->elem);
+        }
+      else
+        slab_destroy (c, s);
+    }
+  lock_release (&c->lock);
+}
+
+/* Reclaimer for the kernel pool.  Frees the empty slab that each
+   cache keeps.  Returns the number of pages freed. */
+static size_t
+kmem_reclaim (enum palloc_flags flags, size_t page_cnt UNUSED) 
+{
+  struct list_elem *e;
+  size_t freed = 0;
+
+  if (flags & PAL_USER)
+    return 0;
+
+  for (e = list_begin (&all_caches); e != list_end (&all_caches);
+       e = list_next (e)) 
+    {
+      struct kmem_cache *c = list_entry (e, struct kmem_cache, elem);
+
+      lock_acquire (&c->lock);
+      if (c->empty != NULL) 
+        {
+          slab_destroy (c, c->empty);
+          freed++;
+        }
+      lock_release (&c->lock);
+    }
+  return freed;
+}
+
+/* Prints statistics for every cache that has been used. */
+void
+kmem_cache_print_stats (void) 
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&all_caches); e != list_end (&all_caches);
+       e = list_next (e)) 
+    {
+      struct kmem_cache *c = list_entry (e, struct kmem_cache, elem);
+      if (c->alloc_cnt == 0)
+        continue;
+      printf ("Slab: %s: %zu-byte objects, %zu in use (peak %zu), "
+              "%zu slabs of %zu, %llu allocations\n",
+              c->name, c->obj_size, c->in_use, c->peak_in_use,
+              c->slab_cnt, c->objs_per_slab, c->alloc_cnt);
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef THREADS_SLAB_H
+#define THREADS_SLAB_H
+
+#include <list.h>
+#include <stddef.h>
+#include "threads/synch.h"
+
+/* Object cache ("slab") allocator for kernel structures that are
+   allocated and freed often.  See slab.c. */
+
+/* Constructor, run on every object of a slab when the slab is
+   created.  Objects must be freed in their constructed state. */
+typedef void kmem_ctor_func (void *obj);
+
+struct slab;
+
+/* A cache of objects of one size. */
+struct kmem_cache
+  {
+    const char *name;           /* Name, for statistics. */
+    size_t obj_size;            /* Object size, rounded for alignment. */
+    size_t objs_per_slab;       /* Number of objects in a slab. */
+    size_t objs_ofs;            /* Offset of a slab's first object. */
+    kmem_ctor_func *ctor;       /* Constructor, or null. */
+    struct list_elem elem;      /* Element in the list of all caches. */
+
+    struct lock lock;           /* Protects the members below. */
+    struct list partial;        /* Slabs with at least one free object. */
+    struct slab *empty;         /* Empty slab kept for reuse, or null. */
+    size_t slab_cnt;            /* Slabs held. */
+    size_t in_use;              /* Objects handed out. */
+    size_t peak_in_use;         /* Largest IN_USE seen. */
+    unsigned long long alloc_cnt; /* Number of successful allocations. */
+  };
+
+void slab_init (void);
+void kmem_cache_init (struct kmem_cache *, const char *name, size_t size,
+                      kmem_ctor_func *);
+void *kmem_cache_alloc (struct kmem_cache *);
+void kmem_cache_free (struct kmem_cache *, void *);
+void kmem_cache_print_stats (void);
+
+#endif /* threads/slab.h */
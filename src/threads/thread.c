@@ -317,6 +317,8 @@ thread_exit (void)
       free(f);
     }
 
+  malloc_thread_exit ();
+
   intr_disable ();
   list_remove (&thread_current()->allelem);
   thread_current ()->status = THREAD_DYING;
@@ -422,6 +424,12 @@ idle (void *idle_started_ UNUSED)
 
   for (;;) 
     {
+      /* Clear free pages for later PAL_ZERO requests until some
+         other thread becomes ready or there is nothing left to
+         do. */
+      while (list_empty (&ready_list) && palloc_zero_free_page ())
+        continue;
+
       /* Let someone else run. */
       intr_disable ();
       thread_block ();
@@ -507,6 +515,15 @@ static void
      list_init(&t->children);
      t->exec_file = NULL;
   #endif
+
+  #ifdef VM
+     list_init (&t->mmap_list);
+     t->mapid_count = 0;
+     list_init (&t->frames);
+     t->rss = t->rss_limit = t->wss = 0;
+     t->wss_faults = 0;
+     t->wss_seen = t->wss_scan = 0;
+  #endif
    
      list_push_back (&open_files, &t->allelem);
 }
@@ -6,8 +6,12 @@
 #include <stdint.h>
 #include <kernel/list.h>
 #include <threads/synch.h>
+#include "threads/malloc.h"
 /*pintos 3*/
 #include "lib/kernel/hash.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 /* States in a thread's life cycle. */
 enum thread_status
@@ -123,12 +127,29 @@ typedef int tid_t;
      struct list children;
      struct file *exec_file;
  #endif
+
+     /*pintos 3*/
+#ifdef VM
+     struct supplemental_page_table spt;
+     struct vmstat vmstat;    /* Fault and paging counters (vm/page.c). */
+     struct list frames;      /* Private frames, in local clock order
+                                 (vm/frame.c). */
+     size_t rss;              /* Number of FRAMES. */
+     size_t rss_limit;        /* Max resident frames, 0 for no limit. */
+     size_t wss;              /* Estimated working set, in pages. */
+     unsigned wss_faults;     /* Page faults since the last wss sample. */
+     size_t wss_seen;         /* Accessed frames the clock found since. */
+     size_t wss_scan;         /* Frames the local clock passed since. */
+     struct list mmap_list;   /* Memory-mapped files (mmap). */
+     int mapid_count;
+     void *user_esp;          /* User esp saved on syscall entry. */
+#endif
+
+     /* Owned by threads/malloc.c. */
+     struct magazine magazines[MALLOC_DESC_CNT];
  
      /* Owned by thread.c. */
      unsigned magic;
-
-     /*pintos 3*/
-     struct hash spt;
    };
 
   struct child {
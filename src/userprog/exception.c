@@ -6,6 +6,9 @@
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "userprog/pagedir.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 
 
@@ -154,12 +157,26 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
+#ifdef VM
+  /* Let the supplemental page table bring in the page.  Kernel
+     faults on user addresses (e.g. a syscall copying into a user
+     buffer) are resolved the same way. */
+  if (is_user_vaddr (fault_addr)
+      && vm_handle_fault (fault_addr,
+                          user ? f->esp : thread_current ()->user_esp,
+                          not_present, write))
+    return;
+
+  if (user || is_user_vaddr (fault_addr))
+    exit (-1);
+#else
   if (user) {
    if ((void *)fault_addr >= PHYS_BASE ||
        pagedir_get_page(thread_current()->pagedir, fault_addr) == NULL) {
      exit(-1);
    }
  }
+#endif
 
   /* To implement virtual memory, delete the rest of the function
      body, and replace it with code that brings in the page to
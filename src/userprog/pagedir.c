@@ -8,6 +8,7 @@
 
 static uint32_t *active_pd (void);
 static void invalidate_pagedir (uint32_t *);
+static void invalidate_page (uint32_t *, const void *);
 
 /* Creates a new page directory that has mappings for kernel
    virtual addresses, but none for user virtual addresses.
@@ -152,10 +153,67 @@ pagedir_clear_page (uint32_t *pd, void *upage)
   if (pte != NULL && (*pte & PTE_P) != 0)
     {
       *pte &= ~PTE_P;
-      invalidate_pagedir (pd);
+      invalidate_page (pd, upage);
     }
 }
 
+/* Marks every user virtual page in [START, END) "not present" in
+   page directory PD, like calling pagedir_clear_page() on each of
+   them, but skips whole 4 MB regions that have no page table and
+   invalidates the TLB in one batch, after the entire range has
+   been cleared.  START and END must be page-aligned. */
+void
+pagedir_clear_range (uint32_t *pd, void *start, void *end)
+{
+  uint8_t *upage = start;
+  struct tlb_batch batch;
+
+  ASSERT (pg_ofs (start) == 0);
+  ASSERT (pg_ofs (end) == 0);
+  ASSERT (end <= PHYS_BASE);
+  ASSERT (pd != init_page_dir);
+
+  pagedir_batch_init (&batch, pd);
+  while (upage < (uint8_t *) end)
+    {
+      uint32_t *pde = pd + pd_no (upage);
+
+      if (*pde & PTE_P)
+        {
+          uint32_t *pt = pde_get_pt (*pde);
+          size_t i;
+
+          for (i = pt_no (upage); i < PGSIZE / sizeof *pt
+                 && upage < (uint8_t *) end; i++, upage += PGSIZE)
+            if (pt[i] & PTE_P)
+              {
+                pt[i] &= ~PTE_P;
+                pagedir_batch_add (&batch, upage);
+              }
+        }
+      else
+        upage = (uint8_t *) ((pd_no (upage) + 1) << PDSHIFT);
+    }
+
+  pagedir_batch_flush (&batch);
+}
+
+/* Sets the writable bit in the PTE for virtual page VPAGE in PD
+   to WRITABLE.  Other bits in the page table entry, including the
+   accessed and dirty bits, are preserved.  VPAGE must be mapped. */
+void
+pagedir_set_writable (uint32_t *pd, const void *vpage, bool writable)
+{
+  uint32_t *pte = lookup_page (pd, vpage, false);
+
+  ASSERT (pte != NULL && (*pte & PTE_P) != 0);
+  if (writable)
+    *pte |= PTE_W;
+  else
+    *pte &= ~(uint32_t) PTE_W;
+  invalidate_page (pd, vpage);
+}
+
 /* Returns true if the PTE for virtual page VPAGE in PD is dirty,
    that is, if the page has been modified since the PTE was
    installed.
@@ -180,7 +238,7 @@ pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty)
       else 
         {
           *pte &= ~(uint32_t) PTE_D;
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
@@ -209,7 +267,7 @@ pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed)
       else 
         {
           *pte &= ~(uint32_t) PTE_A; 
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
@@ -261,3 +319,53 @@ invalidate_pagedir (uint32_t *pd)
       pagedir_activate (pd);
     } 
 }
+
+/* Invalidates the TLB entry for virtual page VPAGE if PD is the
+   active page directory.  Unlike invalidate_pagedir(), this
+   leaves the rest of the TLB, including every other page of the
+   running process, intact.  See [IA32-v2a] "INVLPG--Invalidate
+   TLB Entry". */
+static void
+invalidate_page (uint32_t *pd, const void *vpage)
+{
+  if (active_pd () == pd)
+    asm volatile ("invlpg (%0)" : : "r" (vpage) : "memory");
+}
+
+/* Starts collecting pages of PD whose PTEs are about to change,
+   so that their TLB entries can be invalidated together by
+   pagedir_batch_flush(). */
+void
+pagedir_batch_init (struct tlb_batch *batch, uint32_t *pd)
+{
+  batch->pd = pd;
+  batch->cnt = 0;
+}
+
+/* Adds VPAGE to BATCH.  Once BATCH holds more than
+   TLB_BATCH_MAX pages, it stops remembering them and flushes
+   the whole TLB instead. */
+void
+pagedir_batch_add (struct tlb_batch *batch, const void *vpage)
+{
+  if (batch->cnt < TLB_BATCH_MAX)
+    batch->pages[batch->cnt] = vpage;
+  batch->cnt++;
+}
+
+/* Invalidates the TLB entries of every page added to BATCH,
+   with one invlpg each, or with a single reload of CR3 if there
+   were too many of them.  BATCH is empty afterward. */
+void
+pagedir_batch_flush (struct tlb_batch *batch)
+{
+  if (batch->cnt > TLB_BATCH_MAX)
+    invalidate_pagedir (batch->pd);
+  else if (batch->cnt > 0 && active_pd () == batch->pd)
+    {
+      size_t i;
+      for (i = 0; i < batch->cnt; i++)
+        asm volatile ("invlpg (%0)" : : "r" (batch->pages[i]) : "memory");
+    }
+  batch->cnt = 0;
+}
@@ -2,17 +2,35 @@
 #define USERPROG_PAGEDIR_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+/* Pending TLB invalidations for one page directory.
+   Past TLB_BATCH_MAX pages, one full flush is cheaper than
+   invalidating each page separately. */
+#define TLB_BATCH_MAX 32
+struct tlb_batch
+  {
+    uint32_t *pd;                       /* Page directory. */
+    size_t cnt;                         /* Pages added so far. */
+    const void *pages[TLB_BATCH_MAX];   /* First TLB_BATCH_MAX pages. */
+  };
+
 uint32_t *pagedir_create (void);
 void pagedir_destroy (uint32_t *pd);
 bool pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool rw);
 void *pagedir_get_page (uint32_t *pd, const void *upage);
 void pagedir_clear_page (uint32_t *pd, void *upage);
+void pagedir_clear_range (uint32_t *pd, void *start, void *end);
 bool pagedir_is_dirty (uint32_t *pd, const void *upage);
 void pagedir_set_dirty (uint32_t *pd, const void *upage, bool dirty);
 bool pagedir_is_accessed (uint32_t *pd, const void *upage);
 void pagedir_set_accessed (uint32_t *pd, const void *upage, bool accessed);
+void pagedir_set_writable (uint32_t *pd, const void *upage, bool writable);
 void pagedir_activate (uint32_t *pd);
 
+void pagedir_batch_init (struct tlb_batch *, uint32_t *pd);
+void pagedir_batch_add (struct tlb_batch *, const void *vpage);
+void pagedir_batch_flush (struct tlb_batch *);
+
 #endif /* userprog/pagedir.h */
@@ -7,6 +7,7 @@
 #include <string.h>
 #include "userprog/gdt.h"
 #include "userprog/pagedir.h"
+#include "userprog/syscall.h"
 #include "userprog/tss.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
@@ -17,9 +18,14 @@
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/page.h"
+#endif
 
 static thread_func start_process NO_RETURN;
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
+static void report_load_status (bool success);
 void argument_stack(const char* argv[], int argc, void **esp);
 
 extern struct list open_files;
@@ -91,29 +97,14 @@ tid_t
      if_.cs = SEL_UCSEG;
      if_.eflags = FLAG_IF | FLAG_MBS;
 
+#ifdef VM
      /*pintos 3*/
      spt_init(&thread_current()->spt);
+     thread_current()->rss_limit = vm_rss_limit;
+#endif
    
      success = load (file_name, &if_.eip, &if_.esp);
-     
-     struct thread *cur = thread_current();
-     struct thread *parent = cur->parent;
-     struct list_elem *e;
-     struct child *my_child = NULL;
-   
-     for (e = list_begin(&parent->child_proc); e != list_end(&parent->child_proc); e = list_next(e)) {
-       struct child *c = list_entry(e, struct child, elem);
-       if (c->tid == cur->tid) {
-         my_child = c;
-         break;
-       }
-     }
-   
-     if (my_child != NULL) {
-       my_child->exit_error = success ? 0 : -1;
-     }
-
-     sema_up(&parent->child_lock);
+     report_load_status (success);
 
      if (!success) {
        palloc_free_page(file_name);
@@ -155,6 +146,115 @@ tid_t
      NOT_REACHED ();
 }
 
+/* Tells the parent, blocked in process_execute() or
+   process_fork(), whether the running process was set up
+   successfully. */
+static void
+report_load_status (bool success)
+{
+  struct thread *cur = thread_current ();
+  struct thread *parent = cur->parent;
+  struct list_elem *e;
+
+  for (e = list_begin (&parent->child_proc); e != list_end (&parent->child_proc);
+       e = list_next (e))
+    {
+      struct child *c = list_entry (e, struct child, elem);
+      if (c->tid == cur->tid)
+        {
+          c->exit_error = success ? 0 : -1;
+          break;
+        }
+    }
+
+  sema_up (&parent->child_lock);
+}
+
+#ifdef VM
+/* Handed from process_fork() to the new child. */
+struct fork_info
+  {
+    struct thread *parent;      /* Process calling fork(). */
+    struct intr_frame if_;      /* Its user registers at the call. */
+  };
+
+static thread_func fork_process NO_RETURN;
+
+/* Starts a new process whose address space, open files and
+   memory mappings are copies of the running process's.  Private
+   pages are shared copy-on-write instead of copied.  F is the
+   interrupt frame of the fork() system call; the child resumes
+   from it with 0 as fork()'s return value.  Returns the child's
+   thread id, or TID_ERROR if it could not be created. */
+tid_t
+process_fork (struct intr_frame *f)
+{
+  struct fork_info info;
+  struct child *child_info = NULL;
+  struct list_elem *e;
+  tid_t tid;
+
+  info.parent = thread_current ();
+  info.if_ = *f;
+
+  tid = thread_create (thread_current ()->name, PRI_DEFAULT, fork_process, &info);
+  if (tid == TID_ERROR)
+    return TID_ERROR;
+
+  for (e = list_begin (&thread_current ()->child_proc);
+       e != list_end (&thread_current ()->child_proc); e = list_next (e))
+    {
+      struct child *c = list_entry (e, struct child, elem);
+      if (c->tid == tid)
+        {
+          child_info = c;
+          break;
+        }
+    }
+  if (child_info == NULL)
+    return TID_ERROR;
+
+  /* INFO lives on our stack, and the child reads our address
+     space, so stay put until it is done. */
+  sema_down (&thread_current ()->child_lock);
+
+  if (child_info->exit_error == -1)
+    return TID_ERROR;
+  return tid;
+}
+
+/* Thread function for a child created by process_fork(). */
+static void
+fork_process (void *info_)
+{
+  struct fork_info *info = info_;
+  struct thread *cur = thread_current ();
+  struct thread *parent = info->parent;
+  struct intr_frame if_ = info->if_;
+  bool success;
+
+  spt_init (&cur->spt);
+  cur->rss_limit = parent->rss_limit;
+
+  cur->pagedir = pagedir_create ();
+  success = cur->pagedir != NULL;
+  if (success)
+    {
+      process_activate ();
+      success = fork_files (parent) && spt_fork (&cur->spt, parent, cur->self);
+    }
+
+  report_load_status (success);
+  if (!success)
+    thread_exit ();
+
+  /* fork() returns 0 in the child. */
+  if_.eax = 0;
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+#endif
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
@@ -206,12 +306,16 @@ process_exit (void)
   struct thread *cur = thread_current ();
   uint32_t *pd;
 
-  spt_destroy(&cur->spt);
-
-
     if(cur->exit_error==-100)
       exit(-1);
 
+#ifdef VM
+  /* Write back and drop memory mappings while the SPT and the
+     mapped files are still around, then release every page. */
+  munmap_all();
+  spt_destroy(&cur->spt);
+#endif
+
     int exit_code = cur->exit_error;
     printf("%s: exit(%d)\n",cur->name,exit_code);
 
@@ -456,8 +560,6 @@ load (const char *file_name, void (**eip) (void), void **esp)
 
 /* load() helpers. */
 
-static bool install_page (void *upage, void *kpage, bool writable);
-
 /* Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
 static bool
@@ -526,6 +628,15 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (ofs % PGSIZE == 0);
 
+#ifdef VM
+  /* Nothing is read here: every page is registered in the
+     supplemental page table and faulted in on first access.
+     Read-only pages are shared across processes through the
+     page cache, and pages with nothing to read from the file
+     map the shared zero frame until they are written. */
+  return spt_install_filesys (file, ofs, upage, read_bytes, zero_bytes,
+                              writable);
+#else
   file_seek (file, ofs);
   while (read_bytes > 0 || zero_bytes > 0) 
     {
@@ -561,6 +672,7 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       upage += PGSIZE;
     }
   return true;
+#endif
 }
 
 /* Create a minimal stack by mapping a zeroed page at the top of
@@ -606,6 +718,14 @@ void argument_stack(const char* argv[], int argc, void **esp)
 static bool
 setup_stack (void **esp) 
 {
+#ifdef VM
+  /* Only the top page is mapped now; the page fault handler grows
+     the stack below it on demand, up to vm_stack_page_limit. */
+  if (!vm_grow_stack (((uint8_t *) PHYS_BASE) - PGSIZE))
+    return false;
+  *esp = PHYS_BASE;
+  return true;
+#else
   uint8_t *kpage;
   bool success = false;
 
@@ -619,6 +739,7 @@ setup_stack (void **esp)
       palloc_free_page (kpage);
   }
   return success;
+#endif
 }
 
 /* Adds a mapping from user virtual address UPAGE to kernel
@@ -630,7 +751,7 @@ setup_stack (void **esp)
    with palloc_get_page().
    Returns true on success, false if UPAGE is already mapped or
    if memory allocation fails. */
-static bool
+bool
 install_page (void *upage, void *kpage, bool writable)
 {
   struct thread *t = thread_current ();
@@ -3,9 +3,15 @@
 
 #include "threads/thread.h"
 
+struct intr_frame;
+
 tid_t process_execute (const char *file_name);
+#ifdef VM
+tid_t process_fork (struct intr_frame *);
+#endif
 int process_wait (tid_t);
 void process_exit (void);
 void process_activate (void);
+bool install_page (void *upage, void *kpage, bool writable);
 
 #endif /* userprog/process.h */
@@ -4,8 +4,17 @@
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#include "threads/malloc.h"
+#include "threads/slab.h"
+#include "filesys/file.h"
+#include "userprog/pagedir.h"
 #include "list.h"
 #include "process.h"
+#ifdef VM
+#include <round.h>
+#include <string.h>
+#include "vm/page.h"
+#endif
 
 #define VALIDATE_PTR(ptr)  \
 if (!is_valid_ptr(ptr)) exit(-1);
@@ -30,10 +39,18 @@ int write (int fd, const void *buffer, unsigned size);
 void seek(int fd, unsigned position);
 unsigned tell(int fd);
 void close(int fd);
+#ifdef VM
+int mmap(int fd, void *addr);
+void munmap(int mapid);
+bool vmstat(struct vmstat *st);
+#endif
 
 struct lock fs_lock;
 struct list open_files;
 
+/* Open file descriptors are allocated from their own cache. */
+static struct kmem_cache fd_cache;
+
 extern bool running;
 
 struct file_descriptor {
@@ -43,18 +60,34 @@ struct file_descriptor {
 	struct list_elem elem;
 };
 
+#ifdef VM
+struct mmap_descriptor {
+	int mapid;
+	struct file *file;	/* Reopened, so closing the fd keeps the mapping. */
+	void *addr;
+	size_t page_cnt;
+	struct list_elem elem;
+};
+#endif
+
 void
 syscall_init (void) 
 {
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
   lock_init(&fs_lock);
   list_init(&open_files);
+  kmem_cache_init(&fd_cache, "file_descriptor", sizeof(struct file_descriptor), NULL);
 }
 
 static void
 syscall_handler (struct intr_frame *f UNUSED) 
 {
 	int * p = f->esp;
+#ifdef VM
+	/* Page faults taken inside the kernel need the user's esp
+	   to tell stack growth apart from a bad pointer. */
+	thread_current()->user_esp = f->esp;
+#endif
 	VALIDATE_PTR(p);
 	int system_call = * p;
 	
@@ -135,6 +168,27 @@ syscall_handler (struct intr_frame *f UNUSED)
 		VALIDATE_PTR(p+1);
 		close(*(p+1));
 		break;
+
+#ifdef VM
+		case SYS_MMAP:
+		VALIDATE_PTR(p+2);
+		f->eax = mmap(*(p+1), (void *) *(p+2));
+		break;
+
+		case SYS_MUNMAP:
+		VALIDATE_PTR(p+1);
+		munmap(*(p+1));
+		break;
+
+		case SYS_FORK:
+		f->eax = process_fork(f);
+		break;
+
+		case SYS_VMSTAT:
+		VALIDATE_PTR(p+1);
+		f->eax = vmstat((struct vmstat *) *(p+1));
+		break;
+#endif
 		
 		
 		default:
@@ -182,9 +236,10 @@ exec(char *file_name)
 	strlcpy(fn_cp, file_name, strlen(file_name)+1);
 	
 	char * save_ptr;
-	fn_cp = strtok_r(fn_cp," ",&save_ptr);
+	char * prog_name = strtok_r(fn_cp," ",&save_ptr);
 	
-	struct file* f = filesys_open (fn_cp);
+	struct file* f = filesys_open (prog_name);
+	free(fn_cp);
 	
 	if(f==NULL)
 	{
@@ -253,7 +308,7 @@ open(const char *file_name)
     if (fptr == NULL)
         return -1;
 
-    struct file_descriptor *pfile = malloc(sizeof(*pfile));
+    struct file_descriptor *pfile = kmem_cache_alloc(&fd_cache);
     if (!pfile)
         return -1;
 
@@ -300,10 +355,19 @@ read(int fd, void *buffer, unsigned size)
 	if (fdesc == NULL) {
 		return -1;
 	}
-  
+
+#ifdef VM
+	/* Fault in and pin the whole buffer before taking fs_lock, so
+	   the copy can neither fault nor lose a page to eviction. */
+	if (!vm_pin_user_buffer(buffer, size, true))
+		exit(-1);
+#endif
 	acquire_filesys_lock();
 	int bytes_read = file_read(fdesc->file_struct, buffer, size);
 	release_filesys_lock();
+#ifdef VM
+	vm_unpin_user_buffer(buffer, size);
+#endif
   
 	return bytes_read;
 }
@@ -317,13 +381,16 @@ write (int fd, const void *buffer, unsigned size)
 		exit(-1);
 	}
 
-	acquire_filesys_lock();
-
 	if (fd == STDIN_FILENO) {
-		lock_release(&fs_lock);
 		return -1;
 	}
 
+#ifdef VM
+	if (!vm_pin_user_buffer(buffer, size, false))
+		exit(-1);
+#endif
+	acquire_filesys_lock();
+
 	if (fd == STDOUT_FILENO) {
 		putbuf(buffer, size);
 		status = size;
@@ -337,6 +404,9 @@ write (int fd, const void *buffer, unsigned size)
 	}
 
 	release_filesys_lock();
+#ifdef VM
+	vm_unpin_user_buffer(buffer, size);
+#endif
 	return status;
 }
 
@@ -377,7 +447,7 @@ close_open_file(int fd)
 		if (fd_struct->fd_num == fd) {
 			list_remove(e);
 			file_close(fd_struct->file_struct);
-			free(fd_struct);
+			kmem_cache_free(&fd_cache, fd_struct);
 			return;
 		}
 	}
@@ -405,10 +475,180 @@ close_all_files(struct list* files)
 		struct file_descriptor *f = list_entry (e, struct file_descriptor, elem);
 		file_close(f->file_struct);
 		list_remove(e);
-		free(f);
+		kmem_cache_free(&fd_cache, f);
+	}
+}
+
+#ifdef VM
+int
+mmap(int fd, void *addr)
+{
+	struct thread *cur = thread_current();
+
+	if (addr == NULL || pg_ofs(addr) != 0
+	    || fd == STDIN_FILENO || fd == STDOUT_FILENO)
+		return -1;
+
+	struct file_descriptor *fdesc = get_open_file(fd);
+	if (fdesc == NULL)
+		return -1;
+
+	acquire_filesys_lock();
+	struct file *file = file_reopen(fdesc->file_struct);
+	off_t length = file != NULL ? file_length(file) : 0;
+	release_filesys_lock();
+
+	size_t page_cnt = DIV_ROUND_UP(length, PGSIZE);
+	size_t i;
+	bool ok = length > 0;
+
+	/* The whole range must be unused user address space. */
+	for (i = 0; ok && i < page_cnt; i++) {
+		void *upage = (uint8_t *) addr + i * PGSIZE;
+		ok = is_user_vaddr(upage)
+		     && !spt_contains(&cur->spt, upage)
+		     && pagedir_get_page(cur->pagedir, upage) == NULL;
+	}
+
+	struct mmap_descriptor *md = ok ? malloc(sizeof *md) : NULL;
+	if (md == NULL || !spt_install_mmap(file, addr, length)) {
+		free(md);
+		acquire_filesys_lock();
+		file_close(file);
+		release_filesys_lock();
+		return -1;
 	}
+
+	md->mapid = cur->mapid_count++;
+	md->file = file;
+	md->addr = addr;
+	md->page_cnt = page_cnt;
+	list_push_back(&cur->mmap_list, &md->elem);
+
+	return md->mapid;
 }
 
+static void
+munmap_descriptor(struct mmap_descriptor *md)
+{
+	spt_remove_mmap(md->addr, md->page_cnt);
+	list_remove(&md->elem);
+
+	acquire_filesys_lock();
+	file_close(md->file);
+	release_filesys_lock();
+	free(md);
+}
+
+void
+munmap(int mapid)
+{
+	struct list_elem *e;
+	struct list *mmaps = &thread_current()->mmap_list;
+
+	for (e = list_begin(mmaps); e != list_end(mmaps); e = list_next(e)) {
+		struct mmap_descriptor *md = list_entry(e, struct mmap_descriptor, elem);
+		if (md->mapid == mapid) {
+			munmap_descriptor(md);
+			return;
+		}
+	}
+}
+
+/* Gives the current process, a child being created by fork(),
+   its own copies of PARENT's open files, running executable and
+   memory mappings.  Every file is reopened, so either process
+   can close its copy, and file positions carry over.  Mappings
+   are installed afresh over the reopened files; spt_fork()
+   writes PARENT's dirty mapped pages back first. */
+bool
+fork_files(struct thread *parent)
+{
+	struct thread *cur = thread_current();
+	struct list_elem *e;
+	bool success = true;
+
+	acquire_filesys_lock();
+	if (parent->self != NULL) {
+		cur->self = file_reopen(parent->self);
+		if (cur->self != NULL)
+			file_deny_write(cur->self);
+		else
+			success = false;
+	}
+
+	for (e = list_begin(&parent->files); success && e != list_end(&parent->files);
+	     e = list_next(e)) {
+		struct file_descriptor *pf = list_entry(e, struct file_descriptor, elem);
+		struct file_descriptor *fd = kmem_cache_alloc(&fd_cache);
+		struct file *file = fd != NULL ? file_reopen(pf->file_struct) : NULL;
+		if (file == NULL) {
+			kmem_cache_free(&fd_cache, fd);
+			success = false;
+			break;
+		}
+		file_seek(file, file_tell(pf->file_struct));
+		fd->fd_num = pf->fd_num;
+		fd->owner = cur->tid;
+		fd->file_struct = file;
+		list_push_back(&cur->files, &fd->elem);
+	}
+	cur->fd_count = parent->fd_count;
+
+	for (e = list_begin(&parent->mmap_list); success && e != list_end(&parent->mmap_list);
+	     e = list_next(e)) {
+		struct mmap_descriptor *pmd = list_entry(e, struct mmap_descriptor, elem);
+		struct mmap_descriptor *md = malloc(sizeof *md);
+		struct file *file = md != NULL ? file_reopen(pmd->file) : NULL;
+		off_t length = file != NULL ? file_length(file) : 0;
+		if ((size_t) length > pmd->page_cnt * PGSIZE)
+			length = pmd->page_cnt * PGSIZE;
+		if (length == 0 || !spt_install_mmap(file, pmd->addr, length)) {
+			file_close(file);
+			free(md);
+			success = false;
+			break;
+		}
+		md->mapid = pmd->mapid;
+		md->file = file;
+		md->addr = pmd->addr;
+		md->page_cnt = DIV_ROUND_UP(length, PGSIZE);
+		list_push_back(&cur->mmap_list, &md->elem);
+	}
+	cur->mapid_count = parent->mapid_count;
+	release_filesys_lock();
+
+	return success;
+}
+
+/* Copies the running process's virtual memory counters to the
+   user buffer ST. */
+bool
+vmstat(struct vmstat *st)
+{
+	struct vmstat kst;
+
+	if (!vm_pin_user_buffer(st, sizeof *st, true))
+		exit(-1);
+	vm_stats_get(thread_current(), &kst);
+	memcpy(st, &kst, sizeof kst);
+	vm_unpin_user_buffer(st, sizeof *st);
+	return true;
+}
+
+/* Unmaps every mapping of the current process, writing dirty
+   pages back.  Called from process_exit() before the SPT goes. */
+void
+munmap_all(void)
+{
+	struct list *mmaps = &thread_current()->mmap_list;
+
+	while (!list_empty(mmaps))
+		munmap_descriptor(list_entry(list_front(mmaps),
+		                             struct mmap_descriptor, elem));
+}
+#endif
+
 bool
 is_valid_ptr(const void *usr_ptr)
 {
@@ -419,7 +659,14 @@ is_valid_ptr(const void *usr_ptr)
 	void *ptr = pagedir_get_page(thread_current()->pagedir, usr_ptr);
 	if (!ptr)
 	{
+#ifdef VM
+		/* Not faulted in yet, but the page fault handler can. */
+		struct thread *t = thread_current();
+		return spt_contains(&t->spt, usr_ptr)
+		       || vm_is_stack_access(usr_ptr, t->user_esp);
+#else
 		return false;
+#endif
 	}
 	return true;
 }
@@ -452,3 +699,15 @@ release_filesys_lock(void)
 {
     lock_release(&fs_lock);
 }
+
+bool
+try_acquire_filesys_lock(void)
+{
+    return lock_try_acquire(&fs_lock);
+}
+
+bool
+filesys_lock_held(void)
+{
+    return lock_held_by_current_thread(&fs_lock);
+}
@@ -1,6 +1,19 @@
 #ifndef USERPROG_SYSCALL_H
 #define USERPROG_SYSCALL_H
 
+#include <stdbool.h>
+
+struct thread;
+
 void syscall_init (void);
 
+void acquire_filesys_lock (void);
+void release_filesys_lock (void);
+bool try_acquire_filesys_lock (void);
+bool filesys_lock_held (void);
+#ifdef VM
+void munmap_all (void);
+bool fork_files (struct thread *parent);
+#endif
+
 #endif /* userprog/syscall.h */
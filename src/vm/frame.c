@@ -1,121 +1,516 @@
 #include "vm/frame.h"
+#include "threads/interrupt.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "threads/synch.h"
+#include "userprog/pagedir.h"
+#include "userprog/syscall.h"
 #include "vm/swap.h"
 #include "vm/page.h"
-#include "lib/kernel/hash.h"
-#include "lib/kernel/list.h"
+#include "vm/pagecache.h"
+#include <round.h>
+#include <string.h>
 
-static struct hash frame_table;
-struct hash frame_map;              // Frame table (hash table)
-struct list frame_list;             // Frame list (for eviction)
-struct lock frame_lock;             // Global frame lock
-struct list_elem *clock_ptr;        // Clock algorithm pointer
+static struct frame_table_entry *frame_table;  // Frame table (user pool 순서의 배열)
+static uint8_t *frame_base;         // user pool의 첫 페이지
+static size_t frame_cnt;            // PAL_USER frame이 나올 수 있는 페이지 수
+static size_t frame_used_cnt;       // 할당된 frame 수
+static struct lock frame_lock;      // Global frame lock
+static size_t clock_hand;           // Clock algorithm pointer (frame_table 인덱스)
+static long long clock_laps;        // clock_hand가 한 바퀴 돈 횟수
+static bool frame_evicting;         // 페이지를 쫓아내는 중 (frame_lock)
 
-static unsigned frame_hash(const struct hash_elem *e, void *aux UNUSED) {
-    const struct frame_table_entry *fte = hash_entry(e, struct frame_table_entry, helem);
-    return hash_bytes(&fte->kpage, sizeof fte->kpage);
-}
+size_t vm_rss_limit = 0;
+
+static void frame_set_owner(struct frame_table_entry *fte, struct thread *t);
+static struct frame_table_entry *pick_frame_to_evict(struct thread *owner);
+static void *frame_evict(struct thread *owner);
+static void frame_evict_entry(struct frame_table_entry *fte);
+static bool frame_needs_write_back(struct frame_table_entry *fte);
+static size_t frame_reclaim(enum palloc_flags flags, size_t page_cnt);
+
+/* KPAGE의 frame table 항목. frame 범위 밖이거나 할당되지 않았으면 NULL. */
+static struct frame_table_entry *frame_lookup(void *kpage) {
+    uint8_t *p = kpage;
+    if (p < frame_base || p >= frame_base + frame_cnt * PGSIZE)
+        return NULL;
 
-static bool frame_less(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED) {
-    const struct frame_table_entry *fte_a = hash_entry(a, struct frame_table_entry, helem);
-    const struct frame_table_entry *fte_b = hash_entry(b, struct frame_table_entry, helem);
-    return fte_a->kpage < fte_b->kpage;
+    struct frame_table_entry *fte = &frame_table[(p - frame_base) / PGSIZE];
+    return fte->used ? fte : NULL;
 }
 
+/* PAL_USER 페이지가 나올 수 있는 범위 전체에 대한 항목을 부팅 때 한 번에 만든다.
+   user pool이 kernel pool에서 페이지를 빌려 올 수 있으므로 두 pool을 모두 덮는다.
+   이후 fault 경로에서는 frame table 때문에 malloc하지 않는다. */
 void frame_init(void) {
-    hash_init(&frame_table, frame_hash, frame_less, NULL);
+    void *base;
+    size_t i;
+
+    palloc_user_pool_range(&base, &frame_cnt);
+    frame_base = base;
+    frame_table = palloc_get_multiple(PAL_ASSERT | PAL_ZERO,
+                                      DIV_ROUND_UP(frame_cnt * sizeof *frame_table, PGSIZE));
+    for (i = 0; i < frame_cnt; i++)
+        frame_table[i].kpage = frame_base + i * PGSIZE;
+
+    frame_used_cnt = 0;
     lock_init(&frame_lock);
+    clock_hand = 0;
+    palloc_register_reclaimer(frame_reclaim);
+}
+
+/* frame table과 page cache는 같은 lock으로 보호된다.
+   spt를 정리하는 동안 eviction이 끼어들지 않도록 밖에서도 잡을 수 있다. */
+void frame_table_lock(void) {
+    lock_acquire(&frame_lock);
+}
+
+void frame_table_unlock(void) {
+    lock_release(&frame_lock);
+}
+
+bool frame_table_lock_held(void) {
+    return lock_held_by_current_thread(&frame_lock);
 }
 
-void *frame_allocate(enum palloc_flags flags, void *upage) {
+/* 새 frame을 할당한다. 남은 frame이 없으면 clock 알고리즘으로 하나를 쫓아낸다.
+   주인 프로세스가 rss_limit에 닿았으면 다른 프로세스 대신 자기 frame을 내놓는다.
+   돌려받은 frame은 pin된 상태이므로, 매핑을 마친 뒤 frame_set_pinned()로 풀어야 한다.
+   SPTE가 NULL이면 page cache가 frame_set_shared()로 주인을 정한다. */
+void *frame_allocate(enum palloc_flags flags, struct supplemental_page_table_entry *spte) {
+    struct thread *owner = spte != NULL ? spte->t : NULL;
+    void *kpage = NULL;
+    bool evicted = false;
+
     lock_acquire(&frame_lock);
 
-    void *kpage = palloc_get_page(flags);
+    if (owner != NULL && owner->rss_limit != 0 && owner->rss >= owner->rss_limit) {
+        kpage = frame_evict(owner);   // 자기 frame이 전부 pin돼 있으면 NULL
+        evicted = kpage != NULL;
+    }
+    if (kpage == NULL)
+        kpage = palloc_get_page(flags);
     if (kpage == NULL) {
-        // eviction 필요 (추후 구현 예정)
-        lock_release(&frame_lock);
-        return NULL;
+        kpage = frame_evict(NULL);
+        evicted = kpage != NULL;
     }
-
-    struct frame_table_entry *fte = malloc(sizeof(struct frame_table_entry));
-    if (fte == NULL) {
-        palloc_free_page(kpage);
+    if (kpage == NULL) {
         lock_release(&frame_lock);
         return NULL;
     }
+    if (evicted && (flags & PAL_ZERO))
+        memset(kpage, 0, PGSIZE);
 
-    fte->kpage = kpage;
-    fte->upage = upage;
-    fte->t = thread_current();
-    fte->pinned = false;
+    ASSERT(pg_ofs(kpage) == 0);
+    ASSERT((uint8_t *) kpage >= frame_base && (uint8_t *) kpage < frame_base + frame_cnt * PGSIZE);
+    struct frame_table_entry *fte = &frame_table[((uint8_t *) kpage - frame_base) / PGSIZE];
+    ASSERT(!fte->used);
 
-    hash_insert(&frame_table, &fte->helem);
+    fte->used = true;
+    fte->upage = spte != NULL ? spte->upage : NULL;
+    frame_set_owner(fte, owner);
+    fte->spte = spte;
+    fte->pce = NULL;
+    fte->cow = false;
+    fte->pin_cnt = 1;
+    fte->referenced = false;
+    frame_used_cnt++;
 
     lock_release(&frame_lock);
     return kpage;
 }
 
-void frame_do_free(void *kpage, bool free_page) {
-    lock_acquire(&frame_lock);
+/* FTE의 주인을 T로 바꾸고 주인의 개인 frame 목록과 rss를 맞춘다. T가 NULL이면 주인이 없다. */
+static void frame_set_owner(struct frame_table_entry *fte, struct thread *t) {
+    if (fte->t != NULL) {
+        list_remove(&fte->owner_elem);
+        fte->t->rss--;
+    }
+    fte->t = t;
+    if (t != NULL) {
+        list_push_back(&t->frames, &fte->owner_elem);
+        t->rss++;
+    }
+}
+
+static void frame_remove(struct frame_table_entry *fte) {
+    frame_set_owner(fte, NULL);
+    fte->used = false;
+    fte->spte = NULL;
+    fte->pce = NULL;
+    fte->cow = false;
+    frame_used_cnt--;
+}
 
-    struct frame_table_entry fte_temp;
-    fte_temp.kpage = kpage;
-    struct hash_elem *e = hash_find(&frame_table, &fte_temp.helem);
+void frame_do_free(void *kpage, bool free_page) {
+    bool held = lock_held_by_current_thread(&frame_lock);
+    if (!held)
+        lock_acquire(&frame_lock);
 
-    if (e != NULL) {
-        struct frame_table_entry *fte = hash_entry(e, struct frame_table_entry, helem);
-        hash_delete(&frame_table, e);
-        free(fte);
-    }
+    struct frame_table_entry *fte = frame_lookup(kpage);
+    if (fte != NULL)
+        frame_remove(fte);
 
     if (free_page) {
         palloc_free_page(kpage);
     }
 
-    lock_release(&frame_lock);
+    if (!held)
+        lock_release(&frame_lock);
 }
 
 
+/* KPAGE의 pin 횟수를 늘리거나 줄인다. 공유 frame은 여러 프로세스가
+   동시에 pin할 수 있으므로 마지막 unpin에서야 eviction 대상이 된다. */
 void frame_set_pinned(void *kpage, bool pinned) {
-    lock_acquire(&frame_lock);
+    bool held = lock_held_by_current_thread(&frame_lock);
+    if (!held)
+        lock_acquire(&frame_lock);
+
+    struct frame_table_entry *fte = frame_lookup(kpage);
+    if (fte != NULL) {
+        if (pinned)
+            fte->pin_cnt++;
+        else if (fte->pin_cnt > 0)
+            fte->pin_cnt--;
+    }
+
+    if (!held)
+        lock_release(&frame_lock);
+}
+
+/* KPAGE를 page cache 항목 PCE가 관리하는 공유 frame으로 표시한다.
+   frame_lock을 잡은 상태에서 호출해야 한다. */
+void frame_set_shared(void *kpage, struct page_cache_entry *pce) {
+    ASSERT(lock_held_by_current_thread(&frame_lock));
+
+    struct frame_table_entry *fte = frame_lookup(kpage);
+    ASSERT(fte != NULL);
+    ASSERT(fte->t == NULL);
+    fte->pce = pce;
+    fte->spte = NULL;
+    fte->upage = NULL;
+}
+
+/* OWNER의 개인 frame을 copy-on-write 공유 frame으로 바꾸고 SPTE를 공유자로 더한다.
+   이미 공유 중이면 SPTE만 더한다. 두 spte의 PTE를 읽기 전용으로 만드는 것은
+   호출하는 쪽의 몫이다. frame_lock을 잡은 상태에서 호출해야 한다. */
+void frame_cow_share(struct supplemental_page_table_entry *owner,
+                     struct supplemental_page_table_entry *spte) {
+    ASSERT(lock_held_by_current_thread(&frame_lock));
+
+    struct frame_table_entry *fte = frame_lookup(owner->kpage);
+    ASSERT(fte != NULL && fte->pce == NULL);
+
+    if (!fte->cow) {
+        // 공유 frame은 어느 프로세스의 rss에도 세지 않는다
+        frame_set_owner(fte, NULL);
+        fte->spte = NULL;
+        fte->upage = NULL;
+        fte->cow = true;
+        list_init(&fte->sharers);
+        list_push_back(&fte->sharers, &owner->share_elem);
+        owner->cow = true;
+    }
+    list_push_back(&fte->sharers, &spte->share_elem);
+    spte->cow = true;
+}
+
+/* SPTE가 자기 cow frame의 유일한 공유자라면 그 frame을 SPTE의 개인 frame으로
+   되돌리고 true를 돌려준다. frame_lock을 잡은 상태에서 호출해야 한다. */
+bool frame_cow_make_private(struct supplemental_page_table_entry *spte) {
+    ASSERT(lock_held_by_current_thread(&frame_lock));
+
+    struct frame_table_entry *fte = frame_lookup(spte->kpage);
+    ASSERT(fte != NULL && fte->cow);
+
+    if (list_size(&fte->sharers) != 1)
+        return false;
+
+    list_remove(&spte->share_elem);
+    fte->cow = false;
+    frame_set_owner(fte, spte->t);
+    fte->spte = spte;
+    fte->upage = spte->upage;
+    spte->cow = false;
+    return true;
+}
+
+/* SPTE를 cow frame의 공유자에서 뺀다. 마지막 공유자였다면 frame도 돌려준다.
+   frame_lock을 잡은 상태에서 호출해야 한다. */
+void frame_cow_release(struct supplemental_page_table_entry *spte) {
+    ASSERT(lock_held_by_current_thread(&frame_lock));
+
+    struct frame_table_entry *fte = frame_lookup(spte->kpage);
+    ASSERT(fte != NULL && fte->cow);
+
+    list_remove(&spte->share_elem);
+    spte->cow = false;
+    if (list_empty(&fte->sharers)) {
+        frame_remove(fte);
+        palloc_free_page(spte->kpage);
+    }
+}
+
+long long frame_clock_laps(void) {
+    return clock_laps;
+}
+
+/* 최근 접근 여부를 돌려주고 accessed bit를 지운다 (clock의 두 번째 기회).
+   working set 샘플링이 먼저 거둬 간 bit도 접근으로 친다. */
+static bool frame_test_and_clear_accessed(struct frame_table_entry *fte) {
+    if (fte->pce != NULL)
+        return pagecache_test_and_clear_accessed(fte->pce);
+
+    if (fte->cow) {
+        bool accessed = false;
+        struct list_elem *e;
+        for (e = list_begin(&fte->sharers); e != list_end(&fte->sharers); e = list_next(e)) {
+            struct supplemental_page_table_entry *spte =
+                list_entry(e, struct supplemental_page_table_entry, share_elem);
+            if (pagedir_is_accessed(spte->t->pagedir, spte->upage)) {
+                pagedir_set_accessed(spte->t->pagedir, spte->upage, false);
+                accessed = true;
+            }
+        }
+        return accessed;
+    }
 
-    struct frame_table_entry temp;
-    temp.kpage = kpage;
+    bool accessed = fte->referenced;
+    fte->referenced = false;
 
-    struct hash_elem *e = hash_find(&frame_table, &temp.helem);
-    if (e != NULL) {
-        struct frame_table_entry *fte = hash_entry(e, struct frame_table_entry, helem);
-        fte->pinned = pinned;
+    uint32_t *pd = fte->t->pagedir;
+    if (pagedir_is_accessed(pd, fte->upage)) {
+        pagedir_set_accessed(pd, fte->upage, false);
+        accessed = true;
     }
+    return accessed;
+}
+
+/* T의 working set 추정치에 지난 샘플 이후 접근된 frame 수 SEEN을 반영한다.
+   순간적인 변동을 줄이려고 이전 추정치와 평균을 낸다. */
+static void frame_update_wss(struct thread *t, size_t seen) {
+    if (seen > t->rss)
+        seen = t->rss;
+    t->wss = (t->wss + seen) / 2;
+    t->wss_faults = 0;
+    t->wss_seen = 0;
+    t->wss_scan = 0;
+}
+
+/* 전역 clock이 한 바퀴 돌 때마다 모든 프로세스의 추정치를 갱신한다.
+   fault를 내지 않는 프로세스의 wss도 이렇게 새로 잰다. */
+static void frame_update_wss_lap(struct thread *t, void *aux UNUSED) {
+    if (t->pagedir != NULL)
+        frame_update_wss(t, t->wss_seen);
+}
+
+/* T의 개인 frame 중 지난 샘플 이후 접근된 것을 세어 T->wss를 갱신한다.
+   T->frames만 돌므로 비용은 T의 rss에 비례한다. 그사이 clock이 지운
+   accessed bit는 t->wss_seen에 세어 두었다.
+   accessed bit는 fte->referenced로 옮겨 두므로 clock의 판단은 그대로다. */
+void frame_sample_working_set(struct thread *t) {
+    size_t accessed = 0;
+    struct list_elem *e;
+
+    lock_acquire(&frame_lock);
+    for (e = list_begin(&t->frames); e != list_end(&t->frames); e = list_next(e)) {
+        struct frame_table_entry *fte = list_entry(e, struct frame_table_entry, owner_elem);
 
+        if (pagedir_is_accessed(t->pagedir, fte->upage)) {
+            pagedir_set_accessed(t->pagedir, fte->upage, false);
+            fte->referenced = true;
+            accessed++;
+        }
+    }
+    frame_update_wss(t, accessed + t->wss_seen);
     lock_release(&frame_lock);
 }
 
-void *pick_frame_to_evict(void) {
-    struct hash_iterator i;
-    hash_first(&i, &frame_map);
+/* OWNER의 개인 frame 목록을 OWNER만의 clock으로 돌며 쫓아낼 frame을 고른다.
+   살펴본 frame은 목록 끝으로 보내므로 전역 clock_hand는 움직이지 않는다.
+   한 바퀴 돌 때마다 OWNER의 working set 추정치를 갱신한다.
+   후보가 없으면 NULL을 돌려준다. */
+static struct frame_table_entry *pick_local_frame_to_evict(struct thread *owner) {
+    size_t max_iter = owner->rss * 2;
+    size_t cnt;
+    for (cnt = 0; cnt < max_iter; cnt++) {
+        struct frame_table_entry *fte = list_entry(list_pop_front(&owner->frames),
+                                                   struct frame_table_entry, owner_elem);
+        list_push_back(&owner->frames, &fte->owner_elem);
+        if (++owner->wss_scan >= owner->rss)
+            frame_update_wss(owner, owner->wss_seen);
+
+        if (fte->pin_cnt > 0) continue;
+        if (frame_test_and_clear_accessed(fte)) {
+            owner->wss_seen++;
+            continue;
+        }
+        return fte;
+    }
+    return NULL;
+}
+
+/* clock 알고리즘으로 쫓아낼 frame을 고른다.
+   OWNER가 NULL이 아니면 OWNER의 개인 frame만 후보로 보고, 없으면 NULL을 돌려준다. */
+static struct frame_table_entry *pick_frame_to_evict(struct thread *owner) {
+    if (owner != NULL)
+        return pick_local_frame_to_evict(owner);
 
-    size_t max_iter = hash_size(&frame_map) * 2;
+    size_t max_iter = frame_cnt * 2;
     size_t cnt;
     for (cnt = 0; cnt < max_iter; cnt++) {
-        if (!hash_next(&i)) {
-            hash_first(&i, &frame_map); // 다시 처음부터
+        struct frame_table_entry *fte = &frame_table[clock_hand];
+        if (++clock_hand == frame_cnt) {
+            clock_hand = 0; // 다시 처음부터
+            clock_laps++;
+            enum intr_level old_level = intr_disable();
+            thread_foreach(frame_update_wss_lap, NULL);
+            intr_set_level(old_level);
+        }
+
+        if (!fte->used) continue;
+        if (fte->pin_cnt > 0) continue;
+        if (frame_test_and_clear_accessed(fte)) {
+            if (fte->t != NULL)
+                fte->t->wss_seen++;   // 개인 frame의 accessed bit 샘플
             continue;
         }
+        return fte;
+    }
 
-        struct frame_table_entry *fte = hash_entry(hash_cur(&i), struct frame_table_entry, helem);
+    PANIC("No frame to evict!");
+}
+
+/* user pool이 모자랄 때, 또는 user 쪽에 페이지를 빌려준 kernel pool이 모자랄 때
+   palloc이 부르는 reclaim 콜백.
+   user pool 몫으로는 매핑한 프로세스가 없는 쉬는 page cache frame만 돌려준다.
+   파일 내용과 같아서 I/O 없이 버릴 수 있으므로 clock eviction보다 먼저 쓴다.
+   아직 매핑된 frame은 clock eviction이 접근 여부를 보고 고르도록 둔다.
+   kernel pool 몫(PAL_LENT)으로는 kernel pool에서 빌려 온 frame만 보고, 익명 페이지도
+   swap으로 내보낸다. user pool의 frame을 풀어 봐야 kernel pool에는 도움이 안 된다.
+   단 이미 쫓아내는 중이면 (swap이 kernel 메모리를 할당하다 여기로 온 경우)
+   I/O 없이 버릴 수 있는 page cache frame만 본다. */
+static size_t frame_reclaim(enum palloc_flags flags, size_t page_cnt) {
+    bool lent = flags & PAL_LENT;
+    size_t freed = 0;
+    size_t i;
+
+    if (!(flags & PAL_USER))
+        return 0;
 
-        if (fte->pinned) continue;
+    // frame_allocate()는 frame_lock을 잡은 채 palloc을 부른다.
+    // kernel 할당은 swap_lock 등을 잡은 채 여기로 올 수 있으므로 기다리지 않는다.
+    bool held = lock_held_by_current_thread(&frame_lock);
+    if (!held && !lock_try_acquire(&frame_lock))
+        return 0;
+
+    // 빌려 온 frame은 accessed bit를 한 번 지운 뒤 다시 보도록 두 바퀴 돈다
+    for (i = 0; i < frame_cnt * (lent ? 2 : 1) && freed < page_cnt; i++) {
+        struct frame_table_entry *fte = &frame_table[i % frame_cnt];
+        if (!fte->used || fte->pin_cnt > 0)
+            continue;
+        if (lent && !palloc_page_lent(fte->kpage))
+            continue;
 
-        if (pagedir_is_accessed(fte->t->pagedir, fte->upage)) {
-            pagedir_set_accessed(fte->t->pagedir, fte->upage, false);
+        if (fte->pce != NULL) {
+            // 자기 pool 몫으로는 아무도 매핑하지 않은 쉬는 항목만 버린다
+            if (!lent && fte->pce->refcnt > 0)
+                continue;
+            if (pagecache_test_and_clear_accessed(fte->pce))
+                continue;
+            pagecache_evict(fte->pce);
+            frame_remove(fte);
         } else {
-            return fte->kpage;
+            if (!lent || frame_evicting)
+                continue;
+            if (frame_needs_write_back(fte) && !filesys_lock_held())
+                continue;
+            if (frame_test_and_clear_accessed(fte))
+                continue;
+            frame_evict_entry(fte);
         }
+        palloc_free_page(fte->kpage);
+        freed++;
     }
 
-    PANIC("No frame to evict!");
+    if (!held)
+        lock_release(&frame_lock);
+    return freed;
+}
+
+/* FTE를 쫓아낼 때 파일에 다시 써야 하는가 (수정된 mmap 페이지). */
+static bool frame_needs_write_back(struct frame_table_entry *fte) {
+    struct supplemental_page_table_entry *spte = fte->spte;
+
+    return fte->pce == NULL && !fte->cow && spte != NULL && spte->mmap
+           && (spte->dirty || pagedir_is_dirty(fte->t->pagedir, fte->upage));
+}
+
+/* frame 하나를 쫓아내고 그 kpage를 재사용할 수 있게 돌려준다.
+   OWNER가 NULL이 아니면 OWNER의 frame 중에서만 고른다 (local eviction).
+   frame_lock을 잡은 상태에서 호출된다.
+   수정된 mmap 페이지를 쓰려면 fs_lock이 필요하다. lock 순서는 fs_lock -> frame_lock이고
+   fs_lock을 잡은 syscall이 fault를 내고 frame_lock을 기다릴 수 있으므로,
+   fs_lock을 바로 얻지 못하면 frame_lock을 놓고 fs_lock부터 잡은 뒤 다시 고른다. */
+static void *frame_evict(struct thread *owner) {
+    struct frame_table_entry *fte;
+    bool fs_taken = false;   // 여기서 잡은 fs_lock
+
+    ASSERT(lock_held_by_current_thread(&frame_lock));
+
+    for (;;) {
+        if (frame_used_cnt == 0)
+            fte = NULL;
+        else
+            fte = pick_frame_to_evict(owner);
+        if (fte == NULL || fs_taken || filesys_lock_held() || !frame_needs_write_back(fte))
+            break;
+        if (!try_acquire_filesys_lock()) {
+            lock_release(&frame_lock);
+            acquire_filesys_lock();
+            lock_acquire(&frame_lock);
+            fs_taken = true;
+            continue;   // 기다리는 동안 frame 상태가 바뀌었을 수 있다
+        }
+        fs_taken = true;
+        break;
+    }
+    if (fte == NULL) {
+        if (fs_taken)
+            release_filesys_lock();
+        return NULL;
+    }
+    void *kpage = fte->kpage;
+    frame_evict_entry(fte);
+    if (fs_taken)
+        release_filesys_lock();
+    return kpage;
+}
+
+/* FTE의 페이지를 쫓아내고 frame table에서 뺀다. kpage는 호출자가 다시 쓰거나 돌려준다.
+   frame_lock을 잡은 상태에서 호출된다. */
+static void frame_evict_entry(struct frame_table_entry *fte) {
+    ASSERT(lock_held_by_current_thread(&frame_lock));
+
+    vm_totals.evictions++;   // 프로세스별 횟수는 vm_evict_page()가 센다
+    frame_evicting = true;
+
+    // 공유 frame은 읽기 전용이라 write-back 없이 모든 매핑만 끊는다
+    if (fte->pce != NULL)
+        pagecache_evict(fte->pce);
+    else if (fte->cow) {
+        // cow frame은 공유자마다 따로 쫓아낸다 (각자 swap 슬롯을 받는다)
+        while (!list_empty(&fte->sharers)) {
+            struct supplemental_page_table_entry *spte = list_entry(
+                list_pop_front(&fte->sharers), struct supplemental_page_table_entry, share_elem);
+            spte->cow = false;
+            vm_evict_page(spte);
+        }
+    } else
+        vm_evict_page(fte->spte);
+
+    frame_remove(fte);
+    frame_evicting = false;
 }
@@ -1,24 +1,51 @@
 #ifndef VM_FRAME_H
 #define VM_FRAME_H
 
-#include <hash.h>
 #include <list.h>
 #include <stdbool.h>
 #include "threads/thread.h"
 #include "threads/palloc.h"
 
+struct supplemental_page_table_entry;
+struct page_cache_entry;
 
+/* user pool의 frame마다 하나씩 미리 만들어 두는 항목.
+   (kpage - user pool 시작) / PGSIZE 번째 칸이 그 frame의 항목이다. */
 struct frame_table_entry {
     void *kpage;                  // 물리 주소
-    struct hash_elem helem;      // hash table 요소
-    struct list_elem lelem;      // frame list 요소
+    bool used;                   // 할당된 frame인지
     void *upage;                 // 매핑된 가상 주소
     struct thread *t;           // 이 frame을 소유한 thread
-    bool pinned;                // true면 스왑 금지
+    struct list_elem owner_elem;  // t->frames 항목 (t가 NULL이 아닐 때만)
+    struct supplemental_page_table_entry *spte;  // 개인 frame의 spte
+    struct page_cache_entry *pce;  // 공유 frame이면 page cache 항목
+    bool cow;                   // fork 후 copy-on-write로 공유 중인 frame
+    struct list sharers;        // cow면 이 frame을 매핑한 spte 목록 (share_elem)
+    unsigned pin_cnt;           // 0이 아니면 스왑 금지 (pin 중첩 횟수)
+    bool referenced;            // working set 샘플링이 거둬 간 accessed bit
 };
 
+/* 프로세스당 resident frame 상한의 기본값 (0이면 제한 없음). -rss로 바꾼다. */
+extern size_t vm_rss_limit;
+
+/* 이 횟수만큼 page fault가 날 때마다 working set을 다시 잰다. */
+#define VM_WSS_SAMPLE_FAULTS 64
+
 void frame_init(void);
-void *frame_allocate(enum palloc_flags, void *upage);
+void *frame_allocate(enum palloc_flags, struct supplemental_page_table_entry *spte);
 void frame_do_free(void *kpage, bool free_page);
+void frame_set_pinned(void *kpage, bool pinned);
+void frame_set_shared(void *kpage, struct page_cache_entry *pce);
+void frame_sample_working_set(struct thread *t);
+long long frame_clock_laps(void);
+
+void frame_cow_share(struct supplemental_page_table_entry *owner,
+                     struct supplemental_page_table_entry *spte);
+bool frame_cow_make_private(struct supplemental_page_table_entry *spte);
+void frame_cow_release(struct supplemental_page_table_entry *spte);
+
+void frame_table_lock(void);
+void frame_table_unlock(void);
+bool frame_table_lock_held(void);
 
 #endif
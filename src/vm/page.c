@@ -1,103 +1,420 @@
 #include "vm/page.h"
 #include "threads/vaddr.h"
+#include "vm/frame.h"
+#include "vm/pagecache.h"
 #include "vm/swap.h"
-#include "threads/malloc.h"
+#include "threads/slab.h"
 #include "threads/thread.h"
 #include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/pte.h"
+#include "threads/interrupt.h"
 #include "userprog/pagedir.h"
+#include "userprog/process.h"
+#include "userprog/syscall.h"
+#include <round.h>
+#include <stdio.h>
 #include <string.h>   // memset, memcpy 등
 
+/* 모든 프로세스가 공유하는 읽기 전용 zero frame.
+   한 번도 쓰지 않은 ALL_ZERO 페이지는 읽기 fault 시 이 frame에
+   매핑되고, 첫 쓰기 fault에서야 개인 frame을 할당받는다. */
+static void *zero_frame;
 
-struct supplemental_page_table_entry *spt_find(struct hash *spt, void *upage);
-bool spt_insert(struct hash *spt, struct supplemental_page_table_entry *spte);
-void *frame_allocate(enum palloc_flags flags, void *upage);
-void frame_do_free(void *kpage);
+size_t vm_stack_page_limit = VM_STACK_PAGE_LIMIT_DEFAULT;
+size_t vm_fault_around_pages = VM_FAULT_AROUND_DEFAULT;
 
+/* PUSHA는 esp를 옮기기 전에 esp 아래 32바이트까지 쓴다. */
+#define STACK_SLACK 32
 
+struct vmstat vm_totals;
 
-unsigned page_hash(const struct hash_elem *e, void *aux UNUSED) {
-  const struct supplemental_page_table_entry *spte = 
-      hash_entry(e, struct supplemental_page_table_entry, elem);
-  return hash_bytes(&spte->upage, sizeof spte->upage);
+// spte와 구간은 자주 만들고 지우므로 전용 cache에서 할당한다
+static struct kmem_cache spte_cache;
+static struct kmem_cache range_cache;
+
+void vm_page_init(void) {
+  zero_frame = palloc_get_page(PAL_ASSERT | PAL_ZERO);
+  kmem_cache_init(&spte_cache, "spte", sizeof(struct supplemental_page_table_entry), NULL);
+  kmem_cache_init(&range_cache, "spt_range", sizeof(struct spt_range), NULL);
+}
+
+/* T의 통계를 ST에 채운다. T가 NULL이면 모든 프로세스의 합계를 채운다.
+   swap 사용량과 clock 바퀴 수는 어느 쪽이든 시스템 전체 값이다. */
+void vm_stats_get(struct thread *t, struct vmstat *st) {
+  size_t disk_slots, zswap_pages;
+
+  *st = t != NULL ? t->vmstat : vm_totals;
+  if (t != NULL) {
+    st->rss = t->rss;
+    st->wss = t->wss;
+  }
+  vm_swap_usage(&disk_slots, &zswap_pages);
+  st->swap_slots = disk_slots;
+  st->zswap_pages = zswap_pages;
+  st->clock_laps = frame_clock_laps();
+}
+
+static void vm_print_one(const char *who, const struct vmstat *st) {
+  printf("VM: %s: %lld zero, %lld file, %lld swap, %lld stack, %lld cow faults; "
+         "%lld evictions, %lld writebacks, %lld swap outs\n",
+         who, st->zero_faults, st->file_faults, st->swap_faults, st->stack_faults,
+         st->cow_faults, st->evictions, st->writebacks, st->swap_outs);
+}
+
+static void vm_print_process(struct thread *t, void *aux UNUSED) {
+  if (t->pagedir != NULL) {
+    vm_print_one(t->name, &t->vmstat);
+    printf("VM: %s: %zu frames resident, working set about %zu pages\n",
+           t->name, t->rss, t->wss);
+  }
+}
+
+/* 종료할 때 전체 통계와 아직 살아 있는 프로세스의 통계를 출력한다. */
+void vm_print_stats(void) {
+  struct vmstat st;
+  enum intr_level old_level;
+
+  vm_stats_get(NULL, &st);
+  vm_print_one("total", &st);
+  printf("VM: %lld swap slots, %lld compressed pages in use; %lld clock laps\n",
+         st.swap_slots, st.zswap_pages, st.clock_laps);
+
+  old_level = intr_disable();
+  thread_foreach(vm_print_process, NULL);
+  intr_set_level(old_level);
 }
 
-bool page_less(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED) {
-  const struct supplemental_page_table_entry *spte_a = 
-      hash_entry(a, struct supplemental_page_table_entry, elem);
-  const struct supplemental_page_table_entry *spte_b = 
-      hash_entry(b, struct supplemental_page_table_entry, elem);
-  return spte_a->upage < spte_b->upage;
+void spt_init(struct supplemental_page_table *spt) {
+  spt->dir = NULL;
+  list_init(&spt->ranges);
 }
 
-void spt_init(struct hash *spt) {
-  hash_init(spt, page_hash, page_less, NULL);
+/* UPAGE에 해당하는 leaf 칸의 주소를 돌려준다.
+   CREATE면 없는 단계를 할당하고, 할당할 수 없거나 사용자 주소가 아니면 NULL. */
+static struct supplemental_page_table_entry **
+spt_slot(struct supplemental_page_table *spt, const void *upage, bool create) {
+  struct supplemental_page_table_entry **leaf;
+
+  if (!is_user_vaddr(upage))
+    return NULL;
+
+  if (spt->dir == NULL) {
+    if (!create || (spt->dir = palloc_get_page(PAL_ZERO)) == NULL)
+      return NULL;
+  }
+  leaf = spt->dir[pd_no(upage)];
+  if (leaf == NULL) {
+    if (!create || (leaf = palloc_get_page(PAL_ZERO)) == NULL)
+      return NULL;
+    spt->dir[pd_no(upage)] = leaf;
+  }
+  return &leaf[pt_no(upage)];
 }
 
-struct supplemental_page_table_entry *spt_find(struct hash *spt, void *upage) {
-  struct supplemental_page_table_entry temp;
-  temp.upage = pg_round_down(upage);
-  struct hash_elem *e = hash_find(spt, &temp.elem);
-  return e ? hash_entry(e, struct supplemental_page_table_entry, elem) : NULL;
+static struct spt_range *spt_range_find(struct supplemental_page_table *spt, const void *upage) {
+  struct list_elem *e;
+
+  for (e = list_begin(&spt->ranges); e != list_end(&spt->ranges); e = list_next(e)) {
+    struct spt_range *r = list_entry(e, struct spt_range, elem);
+    if ((const uint8_t *) upage >= r->start && (const uint8_t *) upage < r->end)
+      return r;
+  }
+  return NULL;
+}
+
+/* 구간 R 안의 UPAGE가 파일에서 읽는 바이트 수. */
+static uint32_t spt_range_read_bytes(const struct spt_range *r, const uint8_t *upage) {
+  uint32_t ofs = upage - r->start;
+  if (r->read_bytes <= ofs)
+    return 0;
+  return r->read_bytes - ofs < PGSIZE ? r->read_bytes - ofs : PGSIZE;
 }
 
-void spt_destroy_func(struct hash_elem *e, void *aux UNUSED) {
-  struct supplemental_page_table_entry *spte = 
-      hash_entry(e, struct supplemental_page_table_entry, elem);
-  free(spte);
+/* 구간 R 안의 UPAGE에 대한 spte를 만들어 table에 넣는다. */
+static struct supplemental_page_table_entry *
+spt_range_materialize(struct supplemental_page_table *spt, struct spt_range *r, uint8_t *upage) {
+  struct supplemental_page_table_entry *spte = kmem_cache_alloc(&spte_cache);
+  if (spte == NULL)
+    return NULL;
+
+  uint32_t ofs = upage - r->start;
+  uint32_t page_read_bytes = spt_range_read_bytes(r, upage);
+
+  spte->upage = upage;
+  spte->kpage = NULL;
+  spte->t = thread_current();
+  // 파일에서 읽을 내용이 없는 페이지는 zero frame을 공유할 수 있다
+  spte->status = page_read_bytes > 0 ? FROM_FILESYS : ALL_ZERO;
+  spte->dirty = false;
+  spte->file = page_read_bytes > 0 ? r->file : NULL;
+  spte->file_offset = r->file_offset + ofs;
+  spte->read_bytes = page_read_bytes;
+  spte->zero_bytes = PGSIZE - page_read_bytes;
+  spte->writable = r->writable;
+  spte->mmap = r->mmap;
+  spte->pce = NULL;
+  spte->cow = false;
+
+  if (!spt_insert(spt, spte)) {
+    kmem_cache_free(&spte_cache, spte);
+    return NULL;
+  }
+  return spte;
 }
 
-void spt_destroy(struct hash *spt) {
-  hash_destroy(spt, spt_destroy_func);
+/* UPAGE를 포함하는 페이지의 spte. 구간에만 기술된 페이지면 이때 만든다. */
+struct supplemental_page_table_entry *spt_find(struct supplemental_page_table *spt, void *upage) {
+  struct supplemental_page_table_entry **slot;
+  struct spt_range *r;
+
+  upage = pg_round_down(upage);
+  slot = spt_slot(spt, upage, false);
+  if (slot != NULL && *slot != NULL)
+    return *slot;
+
+  r = spt_range_find(spt, upage);
+  return r != NULL ? spt_range_materialize(spt, r, upage) : NULL;
 }
 
+/* UPAGE가 spt에 기술돼 있는지만 확인한다. spte를 만들지 않는다. */
+bool spt_contains(struct supplemental_page_table *spt, const void *upage) {
+  struct supplemental_page_table_entry **slot = spt_slot(spt, upage, false);
+  return (slot != NULL && *slot != NULL) || spt_range_find(spt, upage) != NULL;
+}
 
+static void spt_remove(struct supplemental_page_table *spt, struct supplemental_page_table_entry *spte) {
+  struct supplemental_page_table_entry **slot = spt_slot(spt, spte->upage, false);
+  ASSERT(slot != NULL && *slot == spte);
+  *slot = NULL;
+}
+
+/* [UPAGE, UPAGE + PAGE_CNT 페이지)를 구간 하나로 등록한다.
+   기존 구간이나 spte와 겹치면 실패한다. */
+static bool spt_add_range(struct supplemental_page_table *spt, uint8_t *upage, size_t page_cnt,
+                          struct file *file, off_t ofs, uint32_t read_bytes,
+                          bool writable, bool mmap) {
+  uint8_t *end = upage + page_cnt * PGSIZE;
+  struct list_elem *e;
+  uint8_t *p;
+
+  if (end > (uint8_t *) PHYS_BASE || end <= upage)
+    return false;
+  for (e = list_begin(&spt->ranges); e != list_end(&spt->ranges); e = list_next(e)) {
+    struct spt_range *r = list_entry(e, struct spt_range, elem);
+    if (upage < r->end && r->start < end)
+      return false;
+  }
+  for (p = upage; p < end; p += PGSIZE) {
+    struct supplemental_page_table_entry **slot = spt_slot(spt, p, false);
+    if (slot != NULL && *slot != NULL)
+      return false;
+  }
+
+  struct spt_range *r = kmem_cache_alloc(&range_cache);
+  if (r == NULL)
+    return false;
+  r->start = upage;
+  r->end = end;
+  r->file = file;
+  r->file_offset = ofs;
+  r->read_bytes = read_bytes;
+  r->writable = writable;
+  r->mmap = mmap;
+  list_push_back(&spt->ranges, &r->elem);
+  return true;
+}
+
+static void spt_remove_range(struct supplemental_page_table *spt, void *upage) {
+  struct spt_range *r = spt_range_find(spt, upage);
+  ASSERT(r != NULL && r->start == upage);
+  list_remove(&r->elem);
+  kmem_cache_free(&range_cache, r);
+}
 
-bool vm_load_page(struct supplemental_page_table_entry *spte) {
+static void spt_destroy_entry(struct supplemental_page_table_entry *spte) {
+  // 매핑은 spt_destroy()가 한꺼번에 지웠으므로 frame과 swap만 돌려준다
+  switch (spte->status) {
+    case ON_FRAME:
+      if (spte->pce != NULL)
+        pagecache_unmap(spte);
+      else if (spte->cow)
+        frame_cow_release(spte);
+      else
+        frame_do_free(spte->kpage, true);
+      break;
+
+    case ON_SWAP:
+      vm_swap_free(spte->swap_index);
+      break;
+
+    default:
+      break;
+  }
+  kmem_cache_free(&spte_cache, spte);
+}
+
+void spt_destroy(struct supplemental_page_table *spt) {
+  // 정리하는 도중 다른 thread의 eviction이 이 spt의 frame을 건드리지 않도록
+  // frame_lock은 처음 한 번만 잡고, frame_do_free()는 그 lock을 그대로 쓴다
+  frame_table_lock();
+  // 사용자 영역 전체를 한 번에 unmap해서 TLB도 한 번만 비운다.
+  // pagedir_destroy()가 같은 frame을 다시 해제하지 않게 하는 역할도 한다.
+  pagedir_clear_range(thread_current()->pagedir, NULL, PHYS_BASE);
+
+  if (spt->dir != NULL) {
+    size_t i, j;
+    for (i = 0; i < pd_no(PHYS_BASE); i++) {
+      struct supplemental_page_table_entry **leaf = spt->dir[i];
+      if (leaf == NULL)
+        continue;
+      for (j = 0; j < PGSIZE / sizeof *leaf; j++)
+        if (leaf[j] != NULL)
+          spt_destroy_entry(leaf[j]);
+      palloc_free_page(leaf);
+    }
+    palloc_free_page(spt->dir);
+    spt->dir = NULL;
+  }
+
+  // 구간에만 남아 있는 페이지는 돌려줄 frame이나 swap이 없다
+  while (!list_empty(&spt->ranges))
+    kmem_cache_free(&range_cache,
+                    list_entry(list_pop_front(&spt->ranges), struct spt_range, elem));
+  frame_table_unlock();
+}
+
+
+
+/* SPTE의 페이지를 frame에 올려 매핑한다. 통계는 호출자가 센다. */
+static bool vm_do_load_page(struct supplemental_page_table_entry *spte, bool write) {
     ASSERT(spte != NULL);
 
-    // 1. frame 할당
-    void *kpage = frame_allocate(PAL_USER, spte->upage);
+    uint32_t *pd = thread_current()->pagedir;
+
+    if (spte->status == ON_FRAME)
+        return true;  // 이미 로딩된 경우
+
+    // 1. 읽기 fault인 0 페이지는 frame 없이 zero frame을 공유
+    if (spte->status == ALL_ZERO && !write) {
+        if (!pagedir_set_page(pd, spte->upage, zero_frame, false))
+            return false;
+        spte->status = ON_ZERO_FRAME;
+        return true;
+    }
+
+    // 2. 읽기 전용 파일 페이지는 page cache의 frame을 공유
+    if (spte->status == FROM_FILESYS && !spte->writable)
+        return pagecache_map(spte);
+
+    // 3. frame 할당 (매핑이 끝날 때까지 pin된 상태)
+    //    0 페이지는 idle thread가 미리 지워 둔 frame을 받는다
+    bool zero = spte->status == ALL_ZERO || spte->status == ON_ZERO_FRAME;
+    void *kpage = frame_allocate(zero ? PAL_USER | PAL_ZERO : PAL_USER, spte);
     if (kpage == NULL) return false;
 
-    // 2. 페이지 상태에 따라 로딩 방법 결정
+    // 4. 페이지 상태에 따라 로딩 방법 결정
     switch (spte->status) {
         case ALL_ZERO:
-            memset(kpage, 0, PGSIZE);
-            break;
+        case ON_ZERO_FRAME:
+            break;  // frame_allocate()가 이미 0으로 채웠다
 
         case ON_SWAP:
-            if (!swap_in(spte->swap_index, kpage))
-                return false;
+            vm_swap_in(spte->swap_index, kpage);
             break;
 
         case FROM_FILESYS:
-            if (!install_page(spte->upage, kpage, spte->writable)) {
-                frame_do_free(kpage);
+            if (!vm_load_page_from_filesys(spte, kpage)) {
+                frame_do_free(kpage, true);
                 return false;
-                }
-
+            }
             break;
 
         case ON_FRAME:
-            return true;  // 이미 로딩된 경우
+            NOT_REACHED();
     }
 
-    // 3. 매핑 및 상태 업데이트
+    // 5. 매핑 및 상태 업데이트 (zero frame 매핑은 개인 frame으로 교체)
+    if (spte->status == ON_ZERO_FRAME)
+        pagedir_clear_page(pd, spte->upage);
+
     if (!install_page(spte->upage, kpage, spte->writable)) {
-        frame_do_free(kpage);
+        frame_do_free(kpage, true);
         return false;
     }
 
     spte->kpage = kpage;
     spte->status = ON_FRAME;
+    frame_set_pinned(kpage, false);
     return true;
 }
 
+/* SPTE의 페이지를 올리고, fault를 어디서 채웠는지에 따라 한 항목에만 센다. */
+bool vm_load_page(struct supplemental_page_table_entry *spte, bool write) {
+    ASSERT(spte != NULL);
+
+    if (spte->status == ON_FRAME)
+        return true;
+
+    if (spte->status == FROM_FILESYS)
+        VM_STAT_INC(spte->t, file_faults);
+    else if (spte->status == ON_SWAP)
+        VM_STAT_INC(spte->t, swap_faults);
+    else
+        VM_STAT_INC(spte->t, zero_faults);
+    return vm_do_load_page(spte, write);
+}
+
+/* mmap 페이지의 내용을 파일에 다시 쓴다.
+   같은 inode를 읽고 쓰는 syscall과 섞이지 않도록 fs_lock을 잡고 불러야 한다.
+   lock 순서는 fs_lock -> frame_lock이므로, frame_lock을 먼저 잡는 eviction은
+   frame_evict()가 fs_lock을 대신 챙긴다. */
+static void vm_write_back(struct supplemental_page_table_entry *spte) {
+    ASSERT(spte->mmap && spte->kpage != NULL);
+    ASSERT(filesys_lock_held());
+    file_write_at(spte->file, spte->kpage, spte->read_bytes, spte->file_offset);
+    VM_STAT_INC(spte->t, writebacks);
+}
+
+/* SPTE의 frame을 쫓아낸다. frame_lock을 잡은 frame_evict()에서 호출된다.
+   수정되지 않은 파일 페이지는 다시 읽으면 되므로 버리고,
+   수정된 mmap 페이지는 파일에, 그 외에는 swap에 쓴다. */
+void vm_evict_page(struct supplemental_page_table_entry *spte) {
+    ASSERT(spte != NULL && spte->status == ON_FRAME);
+
+    uint32_t *pd = spte->t->pagedir;
+    bool dirty = spte->dirty || pagedir_is_dirty(pd, spte->upage);
+
+    pagedir_clear_page(pd, spte->upage);
+    spte->t->vmstat.evictions++;   // 전체 횟수는 frame마다 frame_evict()가 센다
+
+    if (spte->mmap) {
+        if (dirty)
+            vm_write_back(spte);
+        spte->status = FROM_FILESYS;
+    } else if (!dirty) {
+        spte->status = spte->file != NULL ? FROM_FILESYS : ALL_ZERO;
+    } else {
+        spte->swap_index = vm_swap_out(spte->kpage);
+        VM_STAT_INC(spte->t, swap_outs);
+        spte->status = ON_SWAP;
+        spte->dirty = true;   // 이제 내용은 swap에만 있다
+    }
+    spte->kpage = NULL;
+}
+
 bool vm_load_page_from_filesys(struct supplemental_page_table_entry *spte, void *kpage) {
     ASSERT(spte != NULL);
     ASSERT(spte->file != NULL);
 
+    // syscall 도중 커널에서 난 fault라면 이미 fs_lock을 잡고 있을 수 있다
+    bool held = filesys_lock_held();
+    if (!held)
+        acquire_filesys_lock();
     off_t result = file_read_at(spte->file, kpage, spte->read_bytes, spte->file_offset);
+    if (!held)
+        release_filesys_lock();
+
     if (result != (int)spte->read_bytes) {
         return false;
     }
@@ -106,15 +423,205 @@ bool vm_load_page_from_filesys(struct supplemental_page_table_entry *spte, void
     return true;
 }
 
-bool spt_insert(struct hash *spt, struct supplemental_page_table_entry *spte) {
+/* 구간에만 기술된 UPAGE가 page cache에 올라와 있는 읽기 전용 파일 페이지인가. */
+static bool spt_range_resident(const struct spt_range *r, const uint8_t *upage) {
+  uint32_t read_bytes = spt_range_read_bytes(r, upage);
+
+  return !r->writable && read_bytes > 0
+         && pagecache_contains(file_get_inode(r->file),
+                               r->file_offset + (upage - r->start), read_bytes);
+}
+
+/* UPAGE를 포함하는 정렬된 vm_fault_around_pages 크기의 창 안에서,
+   page cache에 이미 올라와 있는 읽기 전용 파일 페이지를 함께 매핑한다.
+   순차적으로 실행 파일을 읽을 때 페이지마다 trap을 받지 않게 해 준다.
+   spt_find()는 구간의 페이지마다 spte를 만들어 버리므로 쓰지 않고,
+   실제로 매핑할 페이지에만 spte를 만든다. */
+static void vm_fault_around(void *upage) {
+    struct thread *t = thread_current();
+    size_t window = vm_fault_around_pages * PGSIZE;
+
+    if (vm_fault_around_pages < 2)
+        return;
+
+    uint8_t *start = (uint8_t *) ((uintptr_t) upage / window * window);
+    uint8_t *end = start + window;
+    uint8_t *addr;
+
+    for (addr = start; addr < end && addr < (uint8_t *) PHYS_BASE; addr += PGSIZE) {
+        if (addr == upage)
+            continue;
+
+        struct supplemental_page_table_entry **slot = spt_slot(&t->spt, addr, false);
+        struct supplemental_page_table_entry *spte = slot != NULL ? *slot : NULL;
+        if (spte == NULL) {
+            struct spt_range *r = spt_range_find(&t->spt, addr);
+            if (r == NULL || !spt_range_resident(r, addr))
+                continue;
+            spte = spt_range_materialize(&t->spt, r, addr);
+        }
+        if (spte != NULL && spte->status == FROM_FILESYS && !spte->writable)
+            pagecache_map_resident(spte);
+    }
+}
+
+/* ESP 기준으로 ADDR이 stack을 키워서 처리할 수 있는 접근인지 판단한다.
+   stack 한도 안쪽이면서 esp보다 STACK_SLACK 이상 아래가 아니어야 한다. */
+bool vm_is_stack_access(const void *addr, const void *esp) {
+    const uint8_t *stack_bottom = (uint8_t *) PHYS_BASE - vm_stack_page_limit * PGSIZE;
+
+    return (uint8_t *) addr < (uint8_t *) PHYS_BASE
+           && (uint8_t *) addr >= stack_bottom
+           && (uint8_t *) addr + STACK_SLACK >= (uint8_t *) esp;
+}
+
+/* ADDR를 포함하는 새 stack 페이지를 0으로 채워 매핑한다.
+   fault가 아닌 setup_stack()도 부르므로 stack_faults는 호출자가 센다. */
+bool vm_grow_stack(void *addr) {
+    struct thread *t = thread_current();
+    void *upage = pg_round_down(addr);
+
+    if (!spt_install_zeropage(&t->spt, upage, true))
+        return false;
+    return vm_do_load_page(spt_find(&t->spt, upage), true);
+}
+
+/* copy-on-write로 공유 중인 SPTE의 페이지에 쓰려고 한다.
+   마지막 공유자라면 그 frame을 그대로 쓰기 가능하게 되돌리고,
+   아니면 새 frame에 내용을 복사해 개인 frame으로 매핑한다. */
+static bool vm_cow_break(struct supplemental_page_table_entry *spte) {
+    uint32_t *pd = spte->t->pagedir;
+
+    frame_table_lock();
+    if (!spte->cow) {
+        // fault 이후 frame이 쫓겨났다
+        frame_table_unlock();
+        return vm_load_page(spte, true);
+    }
+    VM_STAT_INC(spte->t, cow_faults);
+    if (frame_cow_make_private(spte)) {
+        pagedir_set_writable(pd, spte->upage, true);
+        frame_table_unlock();
+        return true;
+    }
+    frame_table_unlock();
+
+    void *kpage = frame_allocate(PAL_USER, spte);
+    if (kpage == NULL)
+        return false;
+
+    frame_table_lock();
+    if (!spte->cow) {
+        // 할당하는 동안 공유 frame이 쫓겨났다 (이미 cow fault로 셌다)
+        frame_do_free(kpage, true);
+        frame_table_unlock();
+        return vm_do_load_page(spte, true);
+    }
+    memcpy(kpage, spte->kpage, PGSIZE);
+    pagedir_clear_page(pd, spte->upage);
+    if (!install_page(spte->upage, kpage, spte->writable)) {
+        // page table이 이미 있으니 일어나지 않아야 하지만, 그래도 공유 frame은 지킨다
+        pagedir_set_page(pd, spte->upage, spte->kpage, false);
+        frame_do_free(kpage, true);
+        frame_table_unlock();
+        return false;
+    }
+    frame_cow_release(spte);
+    spte->kpage = kpage;
+    spte->dirty = true;   // 이제 파일과 내용이 다를 수 있다
+    frame_table_unlock();
+
+    frame_set_pinned(kpage, false);
+    return true;
+}
+
+bool vm_handle_fault(void *fault_addr, void *esp, bool not_present, bool write) {
+    struct thread *t = thread_current();
+    struct supplemental_page_table_entry *spte = spt_find(&t->spt, fault_addr);
+
+    if (spte == NULL) {
+        if (!not_present || !vm_is_stack_access(fault_addr, esp))
+            return false;
+        VM_STAT_INC(t, stack_faults);
+        return vm_grow_stack(fault_addr);
+    }
+    if (write && !spte->writable)
+        return false;
+
+    // 존재하는 페이지의 권한 위반은 zero frame이나 cow frame에 대한 쓰기만 처리한다.
+    // fault 이후 다른 thread가 cow frame을 쫓아냈을 수 있으므로 frame_lock 아래에서 보고,
+    // 그새 frame을 잃은 쓰기 가능 페이지는 아래에서 다시 올린다
+    if (!not_present) {
+        if (!write)
+            return false;
+        frame_table_lock();
+        bool cow = spte->cow;
+        enum page_status status = spte->status;
+        frame_table_unlock();
+        if (cow)
+            return vm_cow_break(spte);
+        if (status == ON_FRAME)
+            return false;
+    } else if (write && spte->cow)
+        return vm_cow_break(spte);
+
+    bool shared_file = spte->status == FROM_FILESYS && !spte->writable;
+    if (!vm_load_page(spte, write))
+        return false;
+
+    if (shared_file)
+        vm_fault_around(spte->upage);
+
+    if (++t->wss_faults >= VM_WSS_SAMPLE_FAULTS) {
+        t->wss_faults = 0;
+        frame_sample_working_set(t);
+    }
+    return true;
+}
+
+bool spt_insert(struct supplemental_page_table *spt, struct supplemental_page_table_entry *spte) {
     ASSERT(spt != NULL);
     ASSERT(spte != NULL);
 
-    struct hash_elem *prev = hash_insert(spt, &spte->elem);
-    return prev == NULL;  // 중복이 없으면 성공
+    struct supplemental_page_table_entry **slot = spt_slot(spt, spte->upage, true);
+    if (slot == NULL || *slot != NULL)
+        return false;  // 메모리가 없거나 중복
+    *slot = spte;
+    return true;
 }
 
+bool
+spt_install_zeropage(struct supplemental_page_table *spt, void *upage, bool writable) {
+    ASSERT(pg_ofs(upage) == 0);
 
+    if (spt_range_find(spt, upage) != NULL)
+        return false;
+
+    struct supplemental_page_table_entry *spte = kmem_cache_alloc(&spte_cache);
+    if (!spte) return false;
+
+    spte->upage = upage;
+    spte->kpage = NULL;
+    spte->t = thread_current();
+    spte->status = ALL_ZERO;
+    spte->dirty = false;
+    spte->file = NULL;
+    spte->file_offset = 0;
+    spte->read_bytes = 0;
+    spte->zero_bytes = PGSIZE;
+    spte->writable = writable;
+    spte->mmap = false;
+    spte->pce = NULL;
+    spte->cow = false;
+
+    if (!spt_insert(spt, spte)) {
+        kmem_cache_free(&spte_cache, spte);
+        return false;
+    }
+    return true;
+}
+
+/* 실행 파일 segment 하나를 구간 하나로 등록한다. 페이지별 spte는 fault 때 만든다. */
 bool
 spt_install_filesys(struct file *file, off_t ofs, uint8_t *upage,
                     uint32_t read_bytes, uint32_t zero_bytes, bool writable) {
@@ -122,32 +629,286 @@ spt_install_filesys(struct file *file, off_t ofs, uint8_t *upage,
     ASSERT(pg_ofs(upage) == 0);
     ASSERT(ofs % PGSIZE == 0);
 
-    while (read_bytes > 0 || zero_bytes > 0) {
-        size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
-        size_t page_zero_bytes = PGSIZE - page_read_bytes;
+    if (read_bytes + zero_bytes == 0)
+        return true;
+    return spt_add_range(&thread_current()->spt, upage, (read_bytes + zero_bytes) / PGSIZE,
+                         file, ofs, read_bytes, writable, false);
+}
+
+/* FILE의 처음 LENGTH 바이트를 ADDR부터 매핑한다. 실제 내용은 fault 시 읽는다.
+   호출하는 쪽에서 [ADDR, ADDR + LENGTH)가 비어 있는지 확인해야 한다. */
+bool
+spt_install_mmap(struct file *file, void *addr, off_t length) {
+    ASSERT(pg_ofs(addr) == 0);
+    ASSERT(length > 0);
 
-        struct supplemental_page_table_entry *spte = malloc(sizeof *spte);
-        if (!spte) return false;
+    return spt_add_range(&thread_current()->spt, addr, DIV_ROUND_UP(length, PGSIZE),
+                         file, 0, length, true, true);
+}
 
-        spte->upage = upage;
-        spte->kpage = NULL;
-        spte->status = FROM_FILESYS;
-        spte->file = file;
-        spte->file_offset = ofs;
-        spte->read_bytes = page_read_bytes;
-        spte->zero_bytes = page_zero_bytes;
-        spte->writable = writable;
-
-        if (!spt_insert(&thread_current()->spt, spte)) {
-            free(spte);
+/* PARENT의 spte 하나를 현재 프로세스용으로 복제해 SPT에 넣는다.
+   개인 frame에 올라와 있는 페이지는 copy-on-write로 공유하고,
+   swap에 있는 페이지는 새 frame에 읽어 온다. */
+static bool spt_fork_entry(struct supplemental_page_table *spt, struct thread *parent,
+                           struct supplemental_page_table_entry *pspte, struct file *exec_file) {
+    struct supplemental_page_table_entry *spte = kmem_cache_alloc(&spte_cache);
+    if (spte == NULL)
+        return false;
+
+    *spte = *pspte;
+    spte->t = thread_current();
+    spte->kpage = NULL;
+    spte->pce = NULL;
+    spte->cow = false;
+    if (spte->file != NULL)
+        spte->file = exec_file;
+
+    frame_table_lock();
+    switch (pspte->status) {
+        case ON_FRAME:
+            if (pspte->pce != NULL) {
+                // 공유 실행 파일 페이지는 첫 fault에서 page cache로 다시 붙는다
+                spte->status = FROM_FILESYS;
+                break;
+            }
+            // 자식은 새 PTE라 dirty bit가 없으므로 부모의 것을 spte에 옮겨 둔다
+            if (pagedir_is_dirty(parent->pagedir, pspte->upage))
+                pspte->dirty = true;
+            spte->dirty = pspte->dirty;
+            if (!install_page(spte->upage, pspte->kpage, false))
+                goto fail;
+            if (pspte->writable)
+                pagedir_set_writable(parent->pagedir, pspte->upage, false);
+            frame_cow_share(pspte, spte);
+            spte->kpage = pspte->kpage;
+            break;
+
+        case ON_ZERO_FRAME:
+            spte->status = ALL_ZERO;
+            break;
+
+        case ON_SWAP: {
+            // 부모가 멈춰 있는 동안 부모의 swap 슬롯은 바뀌지 않는다
+            frame_table_unlock();
+            void *kpage = frame_allocate(PAL_USER, spte);
+            if (kpage == NULL) {
+                kmem_cache_free(&spte_cache, spte);
+                return false;
+            }
+            vm_swap_read(pspte->swap_index, kpage);
+            frame_table_lock();
+            if (!install_page(spte->upage, kpage, spte->writable)) {
+                frame_do_free(kpage, true);
+                goto fail;
+            }
+            spte->kpage = kpage;
+            spte->status = ON_FRAME;
+            frame_set_pinned(kpage, false);
+            break;
+        }
+
+        default:
+            break;
+    }
+
+    if (!spt_insert(spt, spte)) {
+        if (spte->status == ON_FRAME) {
+            pagedir_clear_page(spte->t->pagedir, spte->upage);
+            if (spte->cow)
+                frame_cow_release(spte);
+            else
+                frame_do_free(spte->kpage, true);
+        }
+        goto fail;
+    }
+    frame_table_unlock();
+    return true;
+
+ fail:
+    frame_table_unlock();
+    kmem_cache_free(&spte_cache, spte);
+    return false;
+}
+
+/* PARENT의 주소 공간을 현재 프로세스의 SPT로 복제한다 (fork).
+   PARENT는 그동안 멈춰 있어야 한다. 실행 파일 페이지는 EXEC_FILE에서
+   읽도록 바꾸고, mmap 영역은 fork_files()가 따로 다시 매핑하므로
+   여기서는 수정된 내용을 파일에 써 두기만 한다. */
+bool spt_fork(struct supplemental_page_table *spt, struct thread *parent, struct file *exec_file) {
+    struct supplemental_page_table *src = &parent->spt;
+    struct list_elem *e;
+    size_t i, j;
+
+    for (e = list_begin(&src->ranges); e != list_end(&src->ranges); e = list_next(e)) {
+        struct spt_range *r = list_entry(e, struct spt_range, elem);
+        if (!r->mmap
+            && !spt_add_range(spt, r->start, (r->end - r->start) / PGSIZE, exec_file,
+                              r->file_offset, r->read_bytes, r->writable, false))
+            return false;
+    }
+
+    if (src->dir == NULL)
+        return true;
+    for (i = 0; i < pd_no(PHYS_BASE); i++) {
+        struct supplemental_page_table_entry **leaf = src->dir[i];
+        if (leaf == NULL)
+            continue;
+        for (j = 0; j < PGSIZE / sizeof *leaf; j++) {
+            struct supplemental_page_table_entry *pspte = leaf[j];
+            if (pspte == NULL)
+                continue;
+
+            if (pspte->mmap) {
+                bool held = filesys_lock_held();
+                if (!held)
+                    acquire_filesys_lock();
+                frame_table_lock();
+                if (pspte->status == ON_FRAME
+                    && (pspte->dirty || pagedir_is_dirty(parent->pagedir, pspte->upage))) {
+                    vm_write_back(pspte);
+                    pagedir_set_dirty(parent->pagedir, pspte->upage, false);
+                    pspte->dirty = false;
+                }
+                frame_table_unlock();
+                if (!held)
+                    release_filesys_lock();
+            } else if (!spt_fork_entry(spt, parent, pspte, exec_file)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/* ADDR부터 PAGE_CNT개의 mmap 페이지를 정리한다.
+   메모리에 올라와 있고 수정된 페이지만 파일에 쓴다.
+   범위 전체를 한 번에 unmap하고 frame_lock도 한 번만 잡는다.
+   write-back에 필요한 fs_lock은 lock 순서대로 frame_lock보다 먼저 잡는다. */
+void
+spt_remove_mmap(void *addr, size_t page_cnt) {
+    struct thread *t = thread_current();
+    uint8_t *upage = addr;
+    size_t i;
+    bool held = filesys_lock_held();
+
+    if (!held)
+        acquire_filesys_lock();
+    frame_table_lock();
+    // present bit만 지우므로 dirty bit는 아래에서 그대로 읽을 수 있다
+    pagedir_clear_range(t->pagedir, addr, upage + page_cnt * PGSIZE);
+    for (i = 0; i < page_cnt; i++, upage += PGSIZE) {
+        // 한 번도 접근하지 않은 페이지는 spte가 없으니 새로 만들지 않는다
+        struct supplemental_page_table_entry **slot = spt_slot(&t->spt, upage, false);
+        if (slot == NULL || *slot == NULL)
+            continue;
+        struct supplemental_page_table_entry *spte = *slot;
+        ASSERT(spte->mmap);
+
+        if (spte->status == ON_FRAME) {
+            if (spte->dirty || pagedir_is_dirty(t->pagedir, upage))
+                vm_write_back(spte);
+            frame_do_free(spte->kpage, true);
+        }
+        spt_remove(&t->spt, spte);
+        kmem_cache_free(&spte_cache, spte);
+    }
+    spt_remove_range(&t->spt, addr);
+    frame_table_unlock();
+    if (!held)
+        release_filesys_lock();
+}
+
+/* ADDR가 속한 페이지를 메모리에 올리고 pin한다.
+   WRITE면 커널이 그 페이지에 쓸 것이므로 개인 frame까지 확보한다. */
+static bool vm_pin_page(const void *addr, bool write) {
+    struct thread *t = thread_current();
+    struct supplemental_page_table_entry *spte = spt_find(&t->spt, (void *) addr);
+
+    if (spte == NULL) {
+        if (!vm_is_stack_access(addr, t->user_esp))
+            return false;
+        VM_STAT_INC(t, stack_faults);   // 사용자 대신 커널이 낸 fault
+        if (!vm_grow_stack((void *) addr))
             return false;
+        spte = spt_find(&t->spt, (void *) addr);
+    }
+    if (write && !spte->writable)
+        return false;
+
+    // 올린 직후 다른 thread가 쫓아낼 수 있으므로 lock 안에서 확인하고 pin한다
+    for (;;) {
+        frame_table_lock();
+        if (spte->status == ON_FRAME && !(write && spte->cow)) {
+            frame_set_pinned(spte->kpage, true);
+            frame_table_unlock();
+            return true;
+        }
+        if (spte->status == ON_ZERO_FRAME && !write) {
+            // zero frame은 frame table에 없으므로 쫓겨나지 않는다
+            frame_table_unlock();
+            return true;
         }
+        bool cow = spte->cow;
+        frame_table_unlock();
 
-        // advance
-        read_bytes -= page_read_bytes;
-        zero_bytes -= page_zero_bytes;
-        ofs += page_read_bytes;
-        upage += PGSIZE;
+        // 커널이 쓸 페이지는 fs_lock을 잡기 전에 미리 복사해 둔다
+        if (!(cow ? vm_cow_break(spte) : vm_load_page(spte, write)))
+            return false;
+    }
+}
+
+static void vm_unpin_page(const void *addr) {
+    struct supplemental_page_table_entry *spte =
+        spt_find(&thread_current()->spt, (void *) addr);
+    if (spte == NULL)
+        return;
+
+    frame_table_lock();
+    if (spte->status == ON_FRAME)
+        frame_set_pinned(spte->kpage, false);
+    frame_table_unlock();
+}
+
+/* user 버퍼 [BUFFER, BUFFER + SIZE)의 모든 페이지를 fault-in하고 pin한다.
+   fs_lock을 잡고 file_read/file_write에 넘기기 전에 불러서,
+   복사 도중 페이지가 쫓겨나 fs_lock 아래에서 fault가 나지 않게 한다.
+   실패하면 이미 pin한 페이지를 풀고 false를 돌려준다.
+   버퍼가 PHYS_BASE를 넘거나 주소 공간 끝을 돌아 넘어가면 (SIZE가 매우 크면)
+   아무것도 pin하지 않고 false. SIZE가 0이면 pin할 것이 없다. */
+bool vm_pin_user_buffer(const void *buffer, size_t size, bool write) {
+    const uint8_t *start = buffer;
+    const uint8_t *end;
+    const uint8_t *first = pg_round_down(start);
+    const uint8_t *upage;
+
+    if (size == 0)
+        return true;
+    if (!is_user_vaddr(start) || size > (size_t) ((uint8_t *) PHYS_BASE - start))
+        return false;
+    end = start + size;
+
+    for (upage = first; upage < end; upage += PGSIZE) {
+        const uint8_t *addr = upage < start ? start : upage;
+        if (!is_user_vaddr(addr) || !vm_pin_page(addr, write)) {
+            if (upage > first)
+                vm_unpin_user_buffer(start, upage - start);
+            return false;
+        }
     }
     return true;
 }
+
+void vm_unpin_user_buffer(const void *buffer, size_t size) {
+    const uint8_t *start = buffer;
+    const uint8_t *end;
+    const uint8_t *upage;
+
+    // vm_pin_user_buffer()가 받아들이지 않았을 버퍼는 pin된 것이 없다
+    if (size == 0 || !is_user_vaddr(start)
+        || size > (size_t) ((uint8_t *) PHYS_BASE - start))
+        return;
+    end = start + size;
+
+    for (upage = pg_round_down(start); upage < end; upage += PGSIZE)
+        vm_unpin_page(upage);
+}
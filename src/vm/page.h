@@ -1,32 +1,30 @@
 #ifndef VM_PAGE_H
 #define VM_PAGE_H
 
-#include "lib/kernel/hash.h"
+#include "lib/kernel/list.h"
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include "filesys/file.h"
+#include "filesys/off_t.h"
+#include "threads/vaddr.h"
+#include <vmstat.h>
 
-typedef int off_t;  // 여기가 핵심!
-
-void spt_init(struct hash *spt);
-void spt_destroy(struct hash *spt);
-
-bool vm_load_page_from_filesys(struct supplemental_page_table_entry *spte, void *kpage);
-
-
+struct thread;
+struct page_cache_entry;
 
 enum page_status {
-  ALL_ZERO,     // 0으로 채울 페이지
-  ON_FRAME,     // 물리 메모리에 있음
-  ON_SWAP,      // 스왑에 있음
-  FROM_FILESYS  // 파일에서 로딩 예정
+  ALL_ZERO,       // 0으로 채울 페이지
+  ON_FRAME,       // 물리 메모리에 있음
+  ON_SWAP,        // 스왑에 있음
+  FROM_FILESYS,   // 파일에서 로딩 예정
+  ON_ZERO_FRAME   // 공유 zero frame에 읽기 전용으로 매핑됨
 };
 
 struct supplemental_page_table_entry {
   void *upage;        // 가상 주소
   void *kpage;        // 현재 할당된 물리 주소 (없으면 NULL)
-  struct hash_elem elem;
+  struct thread *t;   // 이 페이지를 가진 thread
 
   enum page_status status;
   size_t swap_index;
@@ -37,6 +35,73 @@ struct supplemental_page_table_entry {
   uint32_t read_bytes;
   uint32_t zero_bytes;
   bool writable;
+  bool mmap;          // mmap된 파일 페이지면 true (수정 시 파일에 write-back)
+
+  struct page_cache_entry *pce;  // 공유 frame을 매핑 중이면 page cache 항목
+  bool cow;                      // 다른 프로세스와 copy-on-write로 frame을 공유 중
+  struct list_elem share_elem;   // pce->sharers 또는 cow frame의 sharers 요소
 };
 
-#endif
\ No newline at end of file
+/* 여러 페이지에 걸친 파일 또는 0 구간 하나를 한 항목으로 기술한다.
+   구간 안의 페이지는 처음 찾을 때에야 개별 spte가 만들어진다. */
+struct spt_range {
+  uint8_t *start;     // 첫 페이지
+  uint8_t *end;       // 마지막 페이지 다음 주소
+  struct file *file;
+  off_t file_offset;  // start에 대응하는 파일 오프셋
+  uint32_t read_bytes;  // 파일에서 읽는 바이트 수, 나머지는 0
+  bool writable;
+  bool mmap;
+  struct list_elem elem;
+};
+
+/* 프로세스별 supplemental page table.
+   x86 page directory처럼 가상 주소 상위 10비트로 leaf를 고르고,
+   다음 10비트로 leaf 안의 spte 포인터를 고르는 2단계 radix table이다.
+   두 단계 모두 처음 쓸 때 페이지 하나씩 할당한다. */
+struct supplemental_page_table {
+  struct supplemental_page_table_entry ***dir;
+  struct list ranges;  // struct spt_range 목록
+};
+
+/* 한 프로세스의 stack이 자랄 수 있는 최대 페이지 수 (-sl 옵션) */
+#define VM_STACK_PAGE_LIMIT_DEFAULT 2048   // 8 MB
+#define VM_STACK_PAGE_LIMIT_MAX ((size_t) PHYS_BASE / PGSIZE)  // 사용자 주소 공간 전체
+extern size_t vm_stack_page_limit;
+
+/* fault 하나에 함께 매핑할 주변 페이지 창의 크기 (-fa 옵션, 0이면 끔) */
+#define VM_FAULT_AROUND_DEFAULT 16         // 64 KB
+extern size_t vm_fault_around_pages;
+
+/* 모든 프로세스를 합친 fault/paging 통계. */
+extern struct vmstat vm_totals;
+
+/* 프로세스 T와 전체 통계의 FIELD를 하나 올린다. */
+#define VM_STAT_INC(T, FIELD) ((T)->vmstat.FIELD++, vm_totals.FIELD++)
+
+void vm_page_init(void);
+void vm_stats_get(struct thread *t, struct vmstat *st);
+void vm_print_stats(void);
+
+void spt_init(struct supplemental_page_table *spt);
+void spt_destroy(struct supplemental_page_table *spt);
+struct supplemental_page_table_entry *spt_find(struct supplemental_page_table *spt, void *upage);
+bool spt_contains(struct supplemental_page_table *spt, const void *upage);
+bool spt_insert(struct supplemental_page_table *spt, struct supplemental_page_table_entry *spte);
+bool spt_install_zeropage(struct supplemental_page_table *spt, void *upage, bool writable);
+bool spt_install_filesys(struct file *file, off_t ofs, uint8_t *upage,
+                         uint32_t read_bytes, uint32_t zero_bytes, bool writable);
+bool spt_install_mmap(struct file *file, void *addr, off_t length);
+void spt_remove_mmap(void *addr, size_t page_cnt);
+bool spt_fork(struct supplemental_page_table *spt, struct thread *parent, struct file *exec_file);
+
+bool vm_load_page(struct supplemental_page_table_entry *spte, bool write);
+bool vm_load_page_from_filesys(struct supplemental_page_table_entry *spte, void *kpage);
+bool vm_handle_fault(void *fault_addr, void *esp, bool not_present, bool write);
+bool vm_is_stack_access(const void *addr, const void *esp);
+bool vm_grow_stack(void *addr);
+bool vm_pin_user_buffer(const void *buffer, size_t size, bool write);
+void vm_unpin_user_buffer(const void *buffer, size_t size);
+void vm_evict_page(struct supplemental_page_table_entry *spte);
+
+#endif
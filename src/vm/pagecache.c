@@ -0,0 +1,268 @@
+#include "vm/pagecache.h"
+#include "filesys/file.h"
+#include "threads/slab.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "userprog/process.h"
+#include "userprog/syscall.h"
+#include "vm/frame.h"
+#include "vm/page.h"
+
+/* 읽기 전용 실행 파일 페이지의 page cache.
+   같은 바이너리를 여러 번 exec해도 text 페이지는 frame 하나만 쓴다.
+   마지막 프로세스가 매핑을 끊어도 항목은 남겨 두므로, 차례로 exec하는
+   프로세스도 디스크를 다시 읽지 않는다. 쉬는 항목은 eviction과
+   frame_reclaim()이 거둬 가고, 파일 내용이 바뀌면 pagecache_invalidate()가 버린다.
+   모든 항목은 frame_lock으로 보호된다. */
+static struct hash page_cache;
+
+static unsigned pagecache_hash(const struct hash_elem *e, void *aux UNUSED) {
+    const struct page_cache_entry *pce = hash_entry(e, struct page_cache_entry, elem);
+    return hash_int(pce->sector) ^ hash_int(pce->offset) ^ hash_int(pce->read_bytes);
+}
+
+static bool pagecache_less(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED) {
+    const struct page_cache_entry *pa = hash_entry(a, struct page_cache_entry, elem);
+    const struct page_cache_entry *pb = hash_entry(b, struct page_cache_entry, elem);
+    if (pa->sector != pb->sector)
+        return pa->sector < pb->sector;
+    if (pa->offset != pb->offset)
+        return pa->offset < pb->offset;
+    return pa->read_bytes < pb->read_bytes;
+}
+
+static struct kmem_cache pce_cache;
+
+void pagecache_init(void) {
+    hash_init(&page_cache, pagecache_hash, pagecache_less, NULL);
+    kmem_cache_init(&pce_cache, "page_cache_entry", sizeof(struct page_cache_entry), NULL);
+}
+
+static struct page_cache_entry *pagecache_lookup(struct page_cache_entry *key) {
+    struct hash_elem *e = hash_find(&page_cache, &key->elem);
+    return e ? hash_entry(e, struct page_cache_entry, elem) : NULL;
+}
+
+/* 항목과 공유 frame을 해제한다. 아무도 매핑하고 있지 않아야 한다. */
+static void pagecache_free(struct page_cache_entry *pce) {
+    ASSERT(pce->refcnt == 0);
+
+    hash_delete(&page_cache, &pce->elem);
+    frame_do_free(pce->kpage, true);
+    kmem_cache_free(&pce_cache, pce);
+}
+
+/* 현재 프로세스의 SPTE->upage에 공유 frame을 읽기 전용으로 매핑한다. */
+static bool pagecache_attach(struct page_cache_entry *pce,
+                             struct supplemental_page_table_entry *spte) {
+    if (!install_page(spte->upage, pce->kpage, false))
+        return false;
+
+    list_push_back(&pce->sharers, &spte->share_elem);
+    pce->refcnt++;
+    spte->pce = pce;
+    spte->kpage = pce->kpage;
+    spte->status = ON_FRAME;
+    return true;
+}
+
+static void pagecache_key(const struct supplemental_page_table_entry *spte,
+                          struct page_cache_entry *key) {
+    ASSERT(spte->file != NULL);
+    ASSERT(!spte->writable);
+
+    key->sector = inode_get_inumber(file_get_inode(spte->file));
+    key->offset = spte->file_offset;
+    key->read_bytes = spte->read_bytes;
+}
+
+/* SPTE가 가리키는 파일 페이지를 page cache에서 찾아 매핑하고,
+   없으면 새 frame에 읽어 와 캐시에 등록한다. */
+bool pagecache_map(struct supplemental_page_table_entry *spte) {
+    struct page_cache_entry key;
+    struct page_cache_entry *pce;
+    bool success;
+
+    pagecache_key(spte, &key);
+
+    frame_table_lock();
+    pce = pagecache_lookup(&key);
+    if (pce != NULL) {
+        success = pagecache_attach(pce, spte);
+        frame_table_unlock();
+        return success;
+    }
+    frame_table_unlock();
+
+    // 캐시에 없으면 frame_lock 없이 디스크에서 읽어 온다.
+    // 읽고 나서 등록할 때까지 파일이 바뀌지 않도록 fs_lock은 쥐고 있는다
+    void *kpage = frame_allocate(PAL_USER, NULL);
+    if (kpage == NULL)
+        return false;
+    bool fs_held = filesys_lock_held();
+    if (!fs_held)
+        acquire_filesys_lock();
+    if (!vm_load_page_from_filesys(spte, kpage)) {
+        frame_do_free(kpage, true);
+        if (!fs_held)
+            release_filesys_lock();
+        return false;
+    }
+
+    frame_table_lock();
+    pce = pagecache_lookup(&key);
+    if (pce != NULL) {
+        // 그 사이 다른 프로세스가 같은 페이지를 올렸다
+        frame_do_free(kpage, true);
+    } else {
+        pce = kmem_cache_alloc(&pce_cache);
+        if (pce == NULL) {
+            frame_do_free(kpage, true);
+            frame_table_unlock();
+            if (!fs_held)
+                release_filesys_lock();
+            return false;
+        }
+        *pce = key;
+        pce->kpage = kpage;
+        pce->refcnt = 0;
+        list_init(&pce->sharers);
+        hash_insert(&page_cache, &pce->elem);
+        frame_set_shared(kpage, pce);
+        frame_set_pinned(kpage, false);
+    }
+
+    success = pagecache_attach(pce, spte);
+    if (!success && pce->refcnt == 0)
+        pagecache_free(pce);
+    frame_table_unlock();
+    if (!fs_held)
+        release_filesys_lock();
+    return success;
+}
+
+/* SPTE의 페이지가 이미 page cache에 있을 때만 매핑한다.
+   디스크 I/O나 frame 할당은 하지 않는다 (fault-around용). */
+bool pagecache_map_resident(struct supplemental_page_table_entry *spte) {
+    struct page_cache_entry key;
+    struct page_cache_entry *pce;
+    bool success;
+
+    pagecache_key(spte, &key);
+
+    frame_table_lock();
+    pce = pagecache_lookup(&key);
+    success = pce != NULL && pagecache_attach(pce, spte);
+    frame_table_unlock();
+    return success;
+}
+
+/* (INODE, OFFSET, READ_BYTES) 페이지가 page cache에 올라와 있는지 확인한다.
+   spte 없이 물어볼 때 쓴다. */
+bool pagecache_contains(struct inode *inode, off_t offset, uint32_t read_bytes) {
+    struct page_cache_entry key;
+    bool found;
+
+    key.sector = inode_get_inumber(inode);
+    key.offset = offset;
+    key.read_bytes = read_bytes;
+
+    frame_table_lock();
+    found = pagecache_lookup(&key) != NULL;
+    frame_table_unlock();
+    return found;
+}
+
+/* SPTE의 공유 매핑을 끊는다. 마지막 매핑이었어도 항목과 frame은
+   다음 exec을 위해 남겨 둔다. frame_lock을 잡은 상태에서 호출해야 한다. */
+void pagecache_unmap(struct supplemental_page_table_entry *spte) {
+    struct page_cache_entry *pce = spte->pce;
+    ASSERT(pce != NULL);
+
+    pagedir_clear_page(spte->t->pagedir, spte->upage);
+    list_remove(&spte->share_elem);
+    pce->refcnt--;
+
+    spte->pce = NULL;
+    spte->kpage = NULL;
+    spte->status = FROM_FILESYS;
+}
+
+/* INODE의 OFFSET부터 SIZE 바이트와 겹치는 페이지를 page cache에서 버린다.
+   파일에 쓰거나 지운 파일의 block을 돌려줄 때 fs_lock을 잡고 부른다.
+   실행 중인 파일은 쓰기가 막혀 있으므로 보통은 쉬는 항목만 걸린다. */
+void pagecache_invalidate(struct inode *inode, off_t offset, off_t size) {
+    block_sector_t sector = inode_get_inumber(inode);
+
+    if (size <= 0)
+        return;
+
+    bool held = frame_table_lock_held();
+    if (!held)
+        frame_table_lock();
+    // 지우면 iterator가 무효가 되므로 하나 버릴 때마다 처음부터 다시 찾는다
+    for (;;) {
+        struct page_cache_entry *victim = NULL;
+        struct hash_iterator i;
+
+        hash_first(&i, &page_cache);
+        while (victim == NULL && hash_next(&i)) {
+            struct page_cache_entry *pce = hash_entry(hash_cur(&i), struct page_cache_entry, elem);
+            if (pce->sector == sector && pce->offset < offset + size
+                && offset < pce->offset + (off_t) PGSIZE)
+                victim = pce;
+        }
+        if (victim == NULL)
+            break;
+
+        if (victim->refcnt == 0)
+            pagecache_free(victim);
+        else {
+            void *kpage = victim->kpage;
+            pagecache_evict(victim);
+            frame_do_free(kpage, true);
+        }
+    }
+    if (!held)
+        frame_table_unlock();
+}
+
+/* eviction 대상이 된 공유 frame의 모든 매핑을 끊는다.
+   내용은 파일과 같으므로 write-back은 하지 않는다.
+   frame 자체는 호출한 frame_evict()가 재사용한다. */
+void pagecache_evict(struct page_cache_entry *pce) {
+    while (!list_empty(&pce->sharers)) {
+        struct list_elem *e = list_pop_front(&pce->sharers);
+        struct supplemental_page_table_entry *spte =
+            list_entry(e, struct supplemental_page_table_entry, share_elem);
+
+        pagedir_clear_page(spte->t->pagedir, spte->upage);
+        spte->pce = NULL;
+        spte->kpage = NULL;
+        spte->status = FROM_FILESYS;
+    }
+
+    hash_delete(&page_cache, &pce->elem);
+    kmem_cache_free(&pce_cache, pce);
+}
+
+/* 공유 frame을 매핑한 프로세스 중 하나라도 최근에 접근했는지 확인하고
+   모든 accessed bit를 지운다. */
+bool pagecache_test_and_clear_accessed(struct page_cache_entry *pce) {
+    bool accessed = false;
+    struct list_elem *e;
+
+    for (e = list_begin(&pce->sharers); e != list_end(&pce->sharers); e = list_next(e)) {
+        struct supplemental_page_table_entry *spte =
+            list_entry(e, struct supplemental_page_table_entry, share_elem);
+        uint32_t *pd = spte->t->pagedir;
+
+        if (pagedir_is_accessed(pd, spte->upage)) {
+            pagedir_set_accessed(pd, spte->upage, false);
+            accessed = true;
+        }
+    }
+    return accessed;
+}
@@ -0,0 +1,37 @@
+#ifndef VM_PAGECACHE_H
+#define VM_PAGECACHE_H
+
+#include <hash.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "devices/block.h"
+#include "filesys/inode.h"
+#include "filesys/off_t.h"
+
+struct supplemental_page_table_entry;
+
+/* 읽기 전용 실행 파일 페이지 하나를 여러 프로세스가 공유하기 위한 항목.
+   (inode sector, offset, read_bytes)가 같으면 같은 frame을 매핑한다.
+   inode가 닫혀도 남도록 struct inode 대신 디스크 위치로 찾는다. */
+struct page_cache_entry {
+    block_sector_t sector;      // 페이지를 읽어 온 파일의 inode sector
+    off_t offset;               // 파일 내 오프셋
+    uint32_t read_bytes;        // 파일에서 읽은 바이트 수 (나머지는 0)
+    void *kpage;                // 공유 frame
+    size_t refcnt;              // 이 frame을 매핑한 spte 수, 0이면 쉬는 항목
+    struct list sharers;        // 매핑한 spte 목록 (share_elem)
+    struct hash_elem elem;
+};
+
+void pagecache_init(void);
+bool pagecache_map(struct supplemental_page_table_entry *spte);
+bool pagecache_map_resident(struct supplemental_page_table_entry *spte);
+bool pagecache_contains(struct inode *inode, off_t offset, uint32_t read_bytes);
+void pagecache_unmap(struct supplemental_page_table_entry *spte);
+void pagecache_invalidate(struct inode *inode, off_t offset, off_t size);
+void pagecache_evict(struct page_cache_entry *pce);
+bool pagecache_test_and_clear_accessed(struct page_cache_entry *pce);
+
+#endif
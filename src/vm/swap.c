@@ -3,8 +3,12 @@
 #include "threads/vaddr.h"
 #include "threads/palloc.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 #include "devices/block.h"
 #include "lib/kernel/bitmap.h"
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -12,10 +16,233 @@
 static struct block *swap_block;
 static struct bitmap *swap_available;
 static size_t swap_size;
+static struct lock swap_lock;
 
 /* Constants */
 #define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
 
+/* 압축 swap cache (zswap).
+   쫓겨난 페이지는 먼저 kernel pool에 압축해 두고, pool이 차거나
+   잘 압축되지 않을 때만 swap 디스크에 쓴다.
+   swap_index_t 하나로 세 경우를 구분한다:
+     - SWAP_ZERO_INDEX: 0으로 찬 페이지. 메모리도 I/O도 쓰지 않는다.
+     - PHYS_BASE 이상: kernel 주소인 struct zswap_entry 포인터.
+     - 그 외: 디스크 슬롯 번호.
+   kernel pool이 모자라면 zswap_reclaim()이 오래된 항목부터 디스크로 내보낸다.
+   SPTE가 가진 index는 바뀌지 않도록 항목의 머리는 남기고 data만 돌려준다. */
+#define SWAP_ZERO_INDEX ((swap_index_t) -1)
+
+size_t vm_zswap_pool_pages = ZSWAP_POOL_PAGES_DEFAULT;
+static size_t zswap_pool_bytes;     // 현재 pool 사용량
+static size_t zswap_entry_cnt;      // 메모리에 남은 페이지 수
+static struct list zswap_lru;       // 디스크로 내보낼 수 있는 항목, 오래된 것부터
+static uint32_t zswap_buf[PGSIZE / sizeof(uint32_t)];  // 내보낼 때 푸는 곳 (swap_lock)
+
+struct zswap_entry {
+    struct list_elem lru_elem;  // data가 있으면 zswap_lru 항목
+    size_t slot;        // 디스크로 내보냈으면 슬롯 번호, 아니면 BITMAP_ERROR
+    size_t size;        // data 크기, 0이면 모든 word가 fill인 페이지
+    uint32_t fill;
+    uint8_t *data;      // word마다 2비트 tag, 그 뒤에 literal word들
+};
+
+/* 페이지를 32비트 word 단위로 본다.
+   0 word와 바로 앞 word의 반복은 tag만 남기고 나머지는 그대로 복사한다. */
+#define ZSWAP_WORDS (PGSIZE / sizeof(uint32_t))
+#define ZSWAP_TAG_BYTES (ZSWAP_WORDS / 4)
+enum { ZTAG_ZERO, ZTAG_REPEAT, ZTAG_LITERAL };
+
+static bool is_zswap_index(swap_index_t index) {
+    return index != SWAP_ZERO_INDEX && (void *) index >= PHYS_BASE;
+}
+
+static int zswap_tag(const uint32_t *w, size_t i) {
+    if (w[i] == 0)
+        return ZTAG_ZERO;
+    if (i > 0 && w[i] == w[i - 1])
+        return ZTAG_REPEAT;
+    return ZTAG_LITERAL;
+}
+
+/* PAGE를 압축했을 때의 크기를 돌려준다. */
+static size_t zswap_compressed_size(const uint32_t *w) {
+    size_t literals = 0;
+    size_t i;
+    for (i = 0; i < ZSWAP_WORDS; i++)
+        if (zswap_tag(w, i) == ZTAG_LITERAL)
+            literals++;
+    return ZSWAP_TAG_BYTES + literals * sizeof(uint32_t);
+}
+
+static void zswap_encode(const uint32_t *w, uint8_t *out) {
+    uint32_t *lit = (uint32_t *) (out + ZSWAP_TAG_BYTES);
+    size_t i;
+
+    memset(out, 0, ZSWAP_TAG_BYTES);
+    for (i = 0; i < ZSWAP_WORDS; i++) {
+        int tag = zswap_tag(w, i);
+        out[i / 4] |= tag << (i % 4 * 2);
+        if (tag == ZTAG_LITERAL)
+            *lit++ = w[i];
+    }
+}
+
+static void zswap_decode(const uint8_t *in, uint32_t *w) {
+    const uint32_t *lit = (const uint32_t *) (in + ZSWAP_TAG_BYTES);
+    size_t i;
+
+    for (i = 0; i < ZSWAP_WORDS; i++) {
+        switch ((in[i / 4] >> (i % 4 * 2)) & 3) {
+        case ZTAG_ZERO:    w[i] = 0; break;
+        case ZTAG_REPEAT:  w[i] = w[i - 1]; break;
+        default:           w[i] = *lit++; break;
+        }
+    }
+}
+
+/* PAGE를 pool에 넣을 수 있으면 넣고 그 index를 *INDEX에 담아 true를 돌려준다.
+   0 페이지면 SWAP_ZERO_INDEX를 담는다. SWAP_ZERO_INDEX는 BITMAP_ERROR와 값이
+   같으므로 저장 여부는 반환값으로만 알린다.
+   pool이 꽉 찼거나 압축 효과가 적으면 false.
+   malloc이 palloc reclaimer를 거쳐 swap_lock을 잡을 수 있으므로 swap_lock 없이 부른다. */
+static bool zswap_store(const void *page, swap_index_t *index) {
+    const uint32_t *w = page;
+    struct zswap_entry *ze;
+    size_t size = 0;
+    size_t i;
+
+    for (i = 1; i < ZSWAP_WORDS && w[i] == w[0]; i++)
+        continue;
+    if (i == ZSWAP_WORDS) {
+        if (w[0] == 0) {
+            *index = SWAP_ZERO_INDEX;
+            return true;
+        }
+    } else {
+        size = zswap_compressed_size(w);
+        if (size > PGSIZE / 2)
+            return false;
+    }
+
+    // pool 자리를 먼저 잡아 두고 lock 밖에서 할당한다
+    lock_acquire(&swap_lock);
+    if (zswap_pool_bytes + sizeof *ze + size > vm_zswap_pool_pages * PGSIZE) {
+        lock_release(&swap_lock);
+        return false;
+    }
+    zswap_pool_bytes += sizeof *ze + size;
+    lock_release(&swap_lock);
+
+    ze = malloc(sizeof *ze);
+    uint8_t *data = size > 0 ? malloc(size) : NULL;
+    if (ze == NULL || (size > 0 && data == NULL)) {
+        free(ze);
+        free(data);
+        lock_acquire(&swap_lock);
+        zswap_pool_bytes -= sizeof *ze + size;
+        lock_release(&swap_lock);
+        return false;
+    }
+
+    ze->slot = BITMAP_ERROR;
+    ze->size = size;
+    ze->fill = w[0];
+    ze->data = data;
+    if (size > 0)
+        zswap_encode(w, ze->data);
+
+    lock_acquire(&swap_lock);
+    if (size > 0)
+        list_push_back(&zswap_lru, &ze->lru_elem);
+    zswap_entry_cnt++;
+    lock_release(&swap_lock);
+    *index = (swap_index_t) ze;
+    return true;
+}
+
+/* swap_lock을 잡고 부른다. */
+static void zswap_free(swap_index_t index) {
+    struct zswap_entry *ze = (struct zswap_entry *) index;
+
+    if (ze->slot != BITMAP_ERROR) {
+        bitmap_set(swap_available, ze->slot, true);
+        zswap_pool_bytes -= sizeof *ze;
+    } else {
+        if (ze->data != NULL)
+            list_remove(&ze->lru_elem);
+        zswap_pool_bytes -= sizeof *ze + ze->size;
+        zswap_entry_cnt--;
+    }
+    free(ze->data);
+    free(ze);
+}
+
+static void zswap_load(swap_index_t index, void *page) {
+    struct zswap_entry *ze = (struct zswap_entry *) index;
+
+    if (ze->size == 0) {
+        uint32_t *w = page;
+        size_t i;
+        for (i = 0; i < ZSWAP_WORDS; i++)
+            w[i] = ze->fill;
+    } else {
+        zswap_decode(ze->data, page);
+    }
+}
+
+/* SLOT에 PAGE를 쓴다. swap_lock을 잡고 부른다. */
+static void swap_write_slot(size_t slot, const void *page) {
+    int i;
+    for (i = 0; i < SECTORS_PER_PAGE; i++) {
+        block_write(swap_block,
+                    slot * SECTORS_PER_PAGE + i,
+                    (const uint8_t *) page + i * BLOCK_SECTOR_SIZE);
+    }
+}
+
+/* SLOT을 PAGE로 읽는다. swap_lock을 잡고 부른다. */
+static void swap_read_slot(size_t slot, void *page) {
+    int i;
+    for (i = 0; i < SECTORS_PER_PAGE; i++) {
+        block_read(swap_block,
+                   slot * SECTORS_PER_PAGE + i,
+                   (uint8_t *) page + i * BLOCK_SECTOR_SIZE);
+    }
+}
+
+/* kernel pool의 palloc reclaimer.
+   오래된 압축 항목부터 디스크로 내보내고 data를 돌려준다.
+   PAGE_CNT 페이지 분량을 풀었거나 더 내보낼 항목이나 슬롯이 없으면 멈춘다.
+   malloc은 arena가 비어야 페이지를 돌려주므로 푼 바이트를 페이지 수로 어림해 돌려준다. */
+static size_t zswap_reclaim(enum palloc_flags flags, size_t page_cnt) {
+    size_t released = 0;
+
+    if (flags & PAL_USER)
+        return 0;
+    // swap_lock을 잡은 채로는 할당하지 않지만, 다른 thread를 기다리지도 않는다
+    if (lock_held_by_current_thread(&swap_lock) || !lock_try_acquire(&swap_lock))
+        return 0;
+
+    while (released < page_cnt * PGSIZE && !list_empty(&zswap_lru)) {
+        size_t slot = bitmap_scan_and_flip_next(swap_available, 1, true);
+        if (slot == BITMAP_ERROR)
+            break;
+
+        struct zswap_entry *ze = list_entry(list_pop_front(&zswap_lru),
+                                            struct zswap_entry, lru_elem);
+        zswap_decode(ze->data, zswap_buf);
+        swap_write_slot(slot, zswap_buf);
+        free(ze->data);
+        ze->data = NULL;
+        ze->slot = slot;
+        zswap_pool_bytes -= ze->size;
+        zswap_entry_cnt--;
+        released += ze->size;
+    }
+    lock_release(&swap_lock);
+    return DIV_ROUND_UP(released, PGSIZE);
+}
+
 void vm_swap_init(void) {
     ASSERT(SECTORS_PER_PAGE > 0);
     swap_block = block_get_role(BLOCK_SWAP);
@@ -24,48 +251,86 @@ void vm_swap_init(void) {
         NOT_REACHED();
     }
 
+    lock_init(&swap_lock);
     swap_size = block_size(swap_block);
     swap_available = bitmap_create(swap_size / SECTORS_PER_PAGE);
     bitmap_set_all(swap_available, true);
+    list_init(&zswap_lru);
+    palloc_register_reclaimer(zswap_reclaim);
 }
 
-void vm_swap_in(swap_index_t swap_index, void *page) {
-    ASSERT(is_user_vaddr(page));
-    ASSERT(bitmap_test(swap_available, swap_index) == false); // false: 이미 할당된 슬롯이어야 함
+/* SWAP_INDEX의 내용을 PAGE로 읽어 온다. 슬롯은 그대로 남는다 (fork용). */
+void vm_swap_read(swap_index_t swap_index, void *page) {
+    ASSERT(is_kernel_vaddr(page));
 
-    int i;
-    for (i = 0; i < SECTORS_PER_PAGE; i++) {
-        block_read(swap_block,
-                   swap_index * SECTORS_PER_PAGE + i,
-                   page + i * BLOCK_SECTOR_SIZE);
+    // 0 페이지와 압축된 페이지는 디스크를 읽지 않는다
+    if (swap_index == SWAP_ZERO_INDEX) {
+        memset(page, 0, PGSIZE);
+        return;
     }
+    lock_acquire(&swap_lock);
+    if (is_zswap_index(swap_index)) {
+        struct zswap_entry *ze = (struct zswap_entry *) swap_index;
+        if (ze->slot != BITMAP_ERROR)
+            swap_read_slot(ze->slot, page);  // 이미 디스크로 내보냈다
+        else
+            zswap_load(swap_index, page);
+        lock_release(&swap_lock);
+        return;
+    }
+    ASSERT(bitmap_test(swap_available, swap_index) == false); // false: 이미 할당된 슬롯이어야 함
 
-    bitmap_set(swap_available, swap_index, true); // 다시 available로
+    swap_read_slot(swap_index, page);
+    lock_release(&swap_lock);
+}
+
+/* SWAP_INDEX의 내용을 PAGE로 읽어 오고 슬롯을 돌려준다. */
+void vm_swap_in(swap_index_t swap_index, void *page) {
+    vm_swap_read(swap_index, page);
+    vm_swap_free(swap_index);
 }
 
 swap_index_t vm_swap_out(void *page) {
     ASSERT(page >= PHYS_BASE);  // 유저 영역 검증
-    swap_index_t index = bitmap_scan(swap_available, 0, 1, true);
-    if (index == BITMAP_ERROR) PANIC("No available swap slot!");
+    swap_index_t index;
+    if (zswap_store(page, &index))
+        return index;
 
-    int i;
-    for (i = 0; i < SECTORS_PER_PAGE; i++) {
-        block_write(swap_block,
-                    index * SECTORS_PER_PAGE + i,
-                    page + i * BLOCK_SECTOR_SIZE);
-    }
+    lock_acquire(&swap_lock);
+    index = bitmap_scan_and_flip_next(swap_available, 1, true);  // 사용 중(false)으로 바꾼다
+    if (index == BITMAP_ERROR) PANIC("No available swap slot!");
 
-    bitmap_set(swap_available, index, false);  // false: 사용 중
+    swap_write_slot(index, page);
+    lock_release(&swap_lock);
     return index;
 }
 
 void vm_swap_free(swap_index_t swap_index) {
+  if (swap_index == SWAP_ZERO_INDEX)
+    return;
+  if (is_zswap_index(swap_index)) {
+    lock_acquire(&swap_lock);
+    zswap_free(swap_index);
+    lock_release(&swap_lock);
+    return;
+  }
+
   // 1. 유효 범위 검사
   ASSERT(swap_index < swap_size);
 
+  lock_acquire(&swap_lock);
   // 2. 이미 비어있는 슬롯인지 확인
   ASSERT(!bitmap_test(swap_available, swap_index));  // false여야 사용 중이라는 뜻
 
   // 3. 해당 슬롯을 다시 'available' 상태로 설정
   bitmap_set(swap_available, swap_index, true);
-}
\ No newline at end of file
+  lock_release(&swap_lock);
+}
+
+/* 사용 중인 swap 디스크 슬롯 수와 압축 cache에 든 페이지 수를 돌려준다. */
+void vm_swap_usage(size_t *disk_slots, size_t *zswap_pages) {
+  lock_acquire(&swap_lock);
+  *disk_slots = bitmap_count(swap_available, 0, bitmap_size(swap_available), false);
+  *zswap_pages = zswap_entry_cnt;
+  lock_release(&swap_lock);
+}
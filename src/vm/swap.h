@@ -6,9 +6,15 @@
 
 typedef size_t swap_index_t;
 
+/* 압축 swap cache에 쓸 kernel pool 한도 (페이지 수, 0이면 끔). -zswap으로 바꾼다. */
+#define ZSWAP_POOL_PAGES_DEFAULT 16
+extern size_t vm_zswap_pool_pages;
+
 void vm_swap_init(void);
 void vm_swap_in(swap_index_t swap_index, void *page);
+void vm_swap_read(swap_index_t swap_index, void *page);
 swap_index_t vm_swap_out(void *page);
 void vm_swap_free(swap_index_t swap_index);
+void vm_swap_usage(size_t *disk_slots, size_t *zswap_pages);
 
 #endif /* VM_SWAP_H */